@@ -7,6 +7,12 @@ IF EXIST "C:\Program Files (x86)\Microsoft Visual Studio\2022\BuildTools\VC\Auxi
 
 if [%1%]==[] (
   nmake /f MakefileWin all
+) else if [%1%]==[batch] (
+  nmake /f MakefileWin batch
+) else if [%1%]==[simplify] (
+  nmake /f MakefileWin simplify
+) else if [%1%]==[stream] (
+  nmake /f MakefileWin stream
 ) else (
   nmake /f MakefileWin clean
 )
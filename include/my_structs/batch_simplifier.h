@@ -0,0 +1,114 @@
+#pragma once
+#include <my_structs/halfedgedata.h>
+#include <my_structs/simplification.h>
+#include <utils/jobs.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace my_structs {
+// a mesh of the batch, as the buffers of a Mesh (no OpenGL is needed)
+struct BatchMesh {
+  std::string name;
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+};
+
+struct BatchOptions {
+  // faces kept of every mesh, as a fraction of its faces
+  float target_ratio{0.5f};
+  // no collapse with a greater error is done, even if the target isn't reached
+  float max_error{std::numeric_limits<float>::infinity()};
+  float weld_tolerance{0.0f};
+  bool smooth_normals{true};
+  // the meshes smaller than this are packed together in jobs of about this
+  // many faces, the larger ones get a job each
+  std::size_t small_mesh_faces{50000};
+};
+
+struct BatchResult {
+  std::string name;
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  std::size_t faces_before{0};
+  std::size_t faces_after{0};
+  // false if the simplification stopped before the target (max_error, too
+  // few faces or no valid edge left)
+  bool reached_target{false};
+  double seconds{0.0};
+};
+
+// Simplifies one mesh of the batch with MeshSimplification_QEM
+inline BatchResult SimplifyBatchMesh(const BatchMesh& input, const BatchOptions& options) {
+  auto start = std::chrono::steady_clock::now();
+  BatchResult result;
+  result.name = input.name;
+  HalfEdgeMesh mesh(input.vertices, input.indices, options.weld_tolerance);
+  mesh.ReorderByMortonCurve();
+  result.faces_before = mesh.faces.size();
+  std::size_t target = static_cast<std::size_t>(options.target_ratio * result.faces_before);
+  {
+    MeshSimplification_QEM simplification(mesh);
+    result.reached_target = true;
+    while (mesh.faces.size() > target) {
+      // a collapse removes two faces
+      int collapses = static_cast<int>(std::max<std::size_t>(1, (mesh.faces.size() - target) / 2));
+      if (!simplification.SimplifyMesh(collapses, options.max_error)) {
+        result.reached_target = mesh.faces.size() <= target;
+        break;
+      }
+    }
+    simplification.ReorderMesh();
+  }
+  result.faces_after = mesh.faces.size();
+  mesh.ConvertToBuffers(result.vertices, result.indices, options.smooth_normals);
+  result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  return result;
+}
+
+// Simplifies all the meshes with the job system, the results are in the
+// order of the meshes. The largest meshes are submitted first, so they don't
+// finish last on a single worker while the others are idle, and each gets its
+// own job: its construction, the batched edge costs and the export are
+// ParallelFor loops, whose chunks go on the workers of the shared job system
+// and are stolen by the idle ones (the collapses of a mesh are sequential). The small meshes
+// are packed in jobs of about small_mesh_faces faces, so thousands of tiny
+// meshes don't cost thousands of jobs
+inline std::vector<BatchResult> SimplifyBatch(const std::vector<BatchMesh>& meshes, const BatchOptions& options,
+                                              JobSystem& jobs = JobSystem::Shared()) {
+  std::vector<BatchResult> results(meshes.size());
+  std::vector<std::size_t> order(meshes.size());
+  for (std::size_t i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  std::stable_sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+    return meshes[a].indices.size() > meshes[b].indices.size();
+  });
+  TaskGroup group(jobs);
+  std::size_t i = 0;
+  while (i < order.size()) {
+    std::size_t first = i;
+    std::size_t faces = meshes[order[i]].indices.size() / 3;
+    ++i;
+    if (faces < options.small_mesh_faces) {
+      while (i < order.size() && faces + meshes[order[i]].indices.size() / 3 <= options.small_mesh_faces) {
+        faces += meshes[order[i]].indices.size() / 3;
+        ++i;
+      }
+    }
+    std::size_t last = i;
+    group.Run([&meshes, &options, &results, &order, first, last]() {
+      for (std::size_t k = first; k < last; ++k) {
+        results[order[k]] = SimplifyBatchMesh(meshes[order[k]], options);
+      }
+    });
+  }
+  group.Wait();
+  return results;
+}
+}  // namespace my_structs
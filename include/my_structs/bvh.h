@@ -0,0 +1,484 @@
+#pragma once
+#include <my_structs/halfedgedata.h>
+#include <my_structs/parallel.h>
+#include <my_structs/simd.h>
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+namespace my_structs {
+struct RayHit {
+  float t{std::numeric_limits<float>::infinity()};
+  // barycentric coordinates of the hit point (weights of the second and the
+  // third corner of the face, starting from face->edge->next_edge->next_edge->v)
+  float u{0.0f};
+  float v{0.0f};
+  HalfEdgeFace* face{nullptr};
+};
+struct ClosestPointHit {
+  glm::vec3 point{0.0f};
+  float distance{std::numeric_limits<float>::infinity()};
+  HalfEdgeFace* face{nullptr};
+};
+
+// Bounding volume hierarchy over the faces of a HalfEdgeMesh, built with the
+// surface area heuristic. The leaves keep up to four triangles in a packet,
+// so the ray and the point queries test them together with Float4 (see
+// simd.h). After some collapses Refit moves the triangles and the boxes
+// without changing the tree: the removed faces are skipped, the quality of
+// the tree slowly gets worse, so after a large simplification it's better to
+// build it again. The faces are found through HalfEdgeFace::index, so the
+// tree must be built again after ReorderByMortonCurve (that renumbers them)
+class FaceBVH {
+ public:
+  FaceBVH() = default;
+  FaceBVH(const HalfEdgeMesh& mesh) { Build(mesh); }
+
+  void Build(const HalfEdgeMesh& mesh) {
+    CollectFaces(mesh);
+    std::size_t count = mesh.faces.size();
+    nodes.clear();
+    packets.clear();
+    references.resize(count);
+    if (count == 0) return;
+    // bounds and centroids of the faces, used only while building
+    build_bounds.resize(count);
+    centroids.resize(count);
+    ParallelFor(0, count, [&](std::size_t i) {
+      const HalfEdgeFace* f = mesh.faces[i];
+      glm::vec3 p1 = f->edge->next_edge->next_edge->v->position;
+      glm::vec3 p2 = f->edge->v->position;
+      glm::vec3 p3 = f->edge->next_edge->v->position;
+      build_bounds[i].min = glm::min(p1, glm::min(p2, p3));
+      build_bounds[i].max = glm::max(p1, glm::max(p2, p3));
+      centroids[i] = (p1 + p2 + p3) / 3.0f;
+      references[i] = static_cast<std::uint32_t>(i);
+    });
+    build_faces = &mesh.faces;
+    nodes.resize(2 * count);
+    packets.resize(count);
+    node_count = 1;
+    packet_count = 0;
+    BuildNode(0, 0, count, 0);
+    nodes.resize(node_count);
+    packets.resize(packet_count);
+    std::vector<Bounds>().swap(build_bounds);
+    std::vector<glm::vec3>().swap(centroids);
+    std::vector<std::uint32_t>().swap(references);
+    build_faces = nullptr;
+    // the triangles of the packets are written by the refit
+    Refit(mesh);
+  }
+
+  // Moves the triangles of the leaves on the current positions of the faces
+  // and recomputes the boxes from the leaves to the root
+  void Refit(const HalfEdgeMesh& mesh) {
+    CollectFaces(mesh);
+    ParallelFor(0, packets.size(), [&](std::size_t i) {
+      TrianglePacket& packet = packets[i];
+      for (int lane = 0; lane < 4; ++lane) {
+        int index = packet.face[lane];
+        const HalfEdgeFace* f = index >= 0 && index < static_cast<int>(faces_by_index.size()) ? faces_by_index[index] : nullptr;
+        if (f == nullptr) {
+          packet.valid[lane] = 0.0f;
+          for (int axis = 0; axis < 3; ++axis) {
+            packet.v0[axis][lane] = 0.0f;
+            packet.e1[axis][lane] = 0.0f;
+            packet.e2[axis][lane] = 0.0f;
+          }
+          continue;
+        }
+        glm::vec3 p1 = f->edge->next_edge->next_edge->v->position;
+        glm::vec3 p2 = f->edge->v->position;
+        glm::vec3 p3 = f->edge->next_edge->v->position;
+        packet.valid[lane] = MaskTrue();
+        for (int axis = 0; axis < 3; ++axis) {
+          packet.v0[axis][lane] = p1[axis];
+          packet.e1[axis][lane] = p2[axis] - p1[axis];
+          packet.e2[axis][lane] = p3[axis] - p1[axis];
+        }
+      }
+    }, 256);
+    // the children are always allocated after their parent
+    for (std::size_t i = nodes.size(); i-- > 0;) {
+      Node& node = nodes[i];
+      if (node.count > 0) {
+        node.bounds = PacketBounds(packets[node.first]);
+      } else {
+        node.bounds = nodes[node.first].bounds;
+        node.bounds.Grow(nodes[node.first + 1].bounds);
+      }
+    }
+  }
+
+  // Closest intersection of the ray origin + t * direction with t in (t_min, t_max)
+  bool Intersect(const glm::vec3& origin, const glm::vec3& direction, RayHit& hit,
+                 float t_min = 0.0f, float t_max = std::numeric_limits<float>::infinity()) const {
+    hit = RayHit();
+    if (nodes.empty()) return false;
+    glm::vec3 inverse_direction = 1.0f / direction;
+    Vec3x4 o(&origin[0]);
+    Vec3x4 d(&direction[0]);
+    float best = t_max;
+    std::uint32_t stack[kStackSize];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const Node& node = nodes[stack[--top]];
+      if (!node.bounds.IntersectRay(origin, inverse_direction, t_min, best)) continue;
+      if (node.count > 0) {
+        const TrianglePacket& packet = packets[node.first];
+        Vec3x4 e1 = packet.E1(), e2 = packet.E2();
+        Vec3x4 pvec = Cross(d, e2);
+        Float4 det = Dot(e1, pvec);
+        Float4 inverse_det = Float4(1.0f) / det;
+        Vec3x4 tvec = o - packet.V0();
+        Float4 u = Dot(tvec, pvec) * inverse_det;
+        Vec3x4 qvec = Cross(tvec, e1);
+        Float4 v = Dot(d, qvec) * inverse_det;
+        Float4 t = Dot(e2, qvec) * inverse_det;
+        Float4 epsilon(1e-12f);
+        Float4 mask = Float4::Load(packet.valid) & ((det > epsilon) | (det < Float4(-1e-12f))) &
+                      (u >= Float4(0.0f)) & (v >= Float4(0.0f)) & (u + v <= Float4(1.0f)) &
+                      (t > Float4(t_min)) & (t < Float4(best));
+        int lanes = MoveMask(mask);
+        if (lanes == 0) continue;
+        float ts[4], us[4], vs[4];
+        t.Store(ts);
+        u.Store(us);
+        v.Store(vs);
+        for (int lane = 0; lane < 4; ++lane) {
+          if ((lanes >> lane & 1) && ts[lane] < best) {
+            best = ts[lane];
+            hit.t = ts[lane];
+            hit.u = us[lane];
+            hit.v = vs[lane];
+            hit.face = faces_by_index[packet.face[lane]];
+          }
+        }
+      } else {
+        // the near child is visited first
+        std::uint32_t first = node.first, second = node.first + 1;
+        if (direction[node.axis] < 0.0f) std::swap(first, second);
+        stack[top++] = second;
+        stack[top++] = first;
+      }
+    }
+    return hit.face != nullptr;
+  }
+
+  // Closest point of the mesh to point, searched within max_distance
+  bool ClosestPoint(const glm::vec3& point, ClosestPointHit& hit,
+                    float max_distance = std::numeric_limits<float>::infinity()) const {
+    hit = ClosestPointHit();
+    if (nodes.empty()) return false;
+    Vec3x4 p(&point[0]);
+    float best = max_distance < std::numeric_limits<float>::infinity() ? max_distance * max_distance : max_distance;
+    const TrianglePacket* best_packet = nullptr;
+    int best_lane = -1;
+    std::uint32_t stack[kStackSize];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const Node& node = nodes[stack[--top]];
+      if (node.bounds.DistanceSquared(point) > best) continue;
+      if (node.count > 0) {
+        const TrianglePacket& packet = packets[node.first];
+        float distances[4];
+        TriangleDistanceSquared(packet, p).Store(distances);
+        for (int lane = 0; lane < 4; ++lane) {
+          if (distances[lane] < best) {
+            best = distances[lane];
+            best_packet = &packet;
+            best_lane = lane;
+          }
+        }
+      } else {
+        // the near child is visited first (it's pushed last)
+        const Node& left = nodes[node.first];
+        const Node& right = nodes[node.first + 1];
+        if (left.bounds.DistanceSquared(point) < right.bounds.DistanceSquared(point)) {
+          stack[top++] = node.first + 1;
+          stack[top++] = node.first;
+        } else {
+          stack[top++] = node.first;
+          stack[top++] = node.first + 1;
+        }
+      }
+    }
+    if (best_packet == nullptr) return false;
+    glm::vec3 a = best_packet->Corner(best_lane, 0);
+    glm::vec3 b = best_packet->Corner(best_lane, 1);
+    glm::vec3 c = best_packet->Corner(best_lane, 2);
+    hit.point = ClosestPointOnTriangle(point, a, b, c);
+    hit.distance = glm::length(hit.point - point);
+    hit.face = faces_by_index[best_packet->face[best_lane]];
+    return true;
+  }
+
+  std::size_t NodeCount() const { return nodes.size(); }
+
+ private:
+  struct Bounds {
+    glm::vec3 min{std::numeric_limits<float>::max()};
+    glm::vec3 max{-std::numeric_limits<float>::max()};
+    void Grow(const glm::vec3& p) {
+      min = glm::min(min, p);
+      max = glm::max(max, p);
+    }
+    void Grow(const Bounds& b) {
+      min = glm::min(min, b.min);
+      max = glm::max(max, b.max);
+    }
+    float Area() const {
+      glm::vec3 size = max - min;
+      if (size.x < 0.0f) return 0.0f;
+      return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+    bool IntersectRay(const glm::vec3& origin, const glm::vec3& inverse_direction, float t_min, float t_max) const {
+      glm::vec3 t1 = (min - origin) * inverse_direction;
+      glm::vec3 t2 = (max - origin) * inverse_direction;
+      glm::vec3 t_near = glm::min(t1, t2);
+      glm::vec3 t_far = glm::max(t1, t2);
+      float enter = std::max(t_min, std::max(t_near.x, std::max(t_near.y, t_near.z)));
+      float exit = std::min(t_max, std::min(t_far.x, std::min(t_far.y, t_far.z)));
+      return enter <= exit;
+    }
+    float DistanceSquared(const glm::vec3& p) const {
+      glm::vec3 d = glm::max(glm::vec3(0.0f), glm::max(min - p, p - max));
+      return glm::dot(d, d);
+    }
+  };
+  struct Node {
+    Bounds bounds;
+    // leaf: index of the packet, inner node: index of the left child (the
+    // right one follows it)
+    std::uint32_t first{0};
+    // number of faces of the leaf, zero for the inner nodes
+    std::uint32_t count{0};
+    // axis of the split, used to visit the near child first
+    std::uint32_t axis{0};
+  };
+  // four triangles as corner plus two edge vectors, one lane per triangle
+  struct TrianglePacket {
+    float v0[3][4];
+    float e1[3][4];
+    float e2[3][4];
+    // all bits set for the lanes with a face
+    float valid[4];
+    // HalfEdgeFace::index of the faces, -1 for the empty lanes
+    int face[4];
+    Vec3x4 V0() const { return Vec3x4(Float4::Load(v0[0]), Float4::Load(v0[1]), Float4::Load(v0[2])); }
+    Vec3x4 E1() const { return Vec3x4(Float4::Load(e1[0]), Float4::Load(e1[1]), Float4::Load(e1[2])); }
+    Vec3x4 E2() const { return Vec3x4(Float4::Load(e2[0]), Float4::Load(e2[1]), Float4::Load(e2[2])); }
+    bool IsValid(int lane) const {
+      std::uint32_t bits;
+      std::memcpy(&bits, &valid[lane], sizeof(bits));
+      return bits != 0;
+    }
+    glm::vec3 Corner(int lane, int corner) const {
+      glm::vec3 p(v0[0][lane], v0[1][lane], v0[2][lane]);
+      if (corner == 1) p += glm::vec3(e1[0][lane], e1[1][lane], e1[2][lane]);
+      if (corner == 2) p += glm::vec3(e2[0][lane], e2[1][lane], e2[2][lane]);
+      return p;
+    }
+  };
+  static const std::uint32_t kMaxLeafSize = 4;
+  // below this depth the nodes are split at the median, so the depth of the
+  // tree (and the traversal stack) stays bounded
+  static const int kMaxSAHDepth = 64;
+  static const int kStackSize = 128;
+  static const int kBins = 12;
+  // subtrees with more faces than this are built as jobs of the shared job
+  // system (see utils/jobs.h), the thread that waits builds the other one
+  static const std::size_t kParallelBuild = 8192;
+
+  static float MaskTrue() {
+    std::uint32_t bits = 0xFFFFFFFFu;
+    float mask;
+    std::memcpy(&mask, &bits, sizeof(mask));
+    return mask;
+  }
+
+  void CollectFaces(const HalfEdgeMesh& mesh) {
+    int largest = -1;
+    for (auto f : mesh.faces) {
+      largest = std::max(largest, f->index);
+    }
+    faces_by_index.assign(largest + 1, nullptr);
+    for (auto f : mesh.faces) {
+      if (f->index >= 0) faces_by_index[f->index] = f;
+    }
+  }
+
+  // splits references[first, first + count) with the binned SAH, the
+  // references are positions in the faces of the mesh
+  void BuildNode(std::uint32_t node_index, std::size_t first, std::size_t count, int depth) {
+    Bounds centroid_bounds;
+    for (std::size_t i = first; i < first + count; ++i) {
+      centroid_bounds.Grow(centroids[references[i]]);
+    }
+    if (count <= kMaxLeafSize) {
+      MakeLeaf(node_index, first, count);
+      return;
+    }
+    int best_axis = -1;
+    int best_split = 0;
+    float best_cost = std::numeric_limits<float>::infinity();
+    glm::vec3 extent = centroid_bounds.max - centroid_bounds.min;
+    for (int axis = 0; axis < 3 && depth < kMaxSAHDepth; ++axis) {
+      if (extent[axis] <= 0.0f) continue;
+      Bounds bins[kBins];
+      std::size_t bin_counts[kBins] = {0};
+      float scale = kBins / extent[axis];
+      for (std::size_t i = first; i < first + count; ++i) {
+        std::size_t slot = references[i];
+        int bin = std::min(kBins - 1, static_cast<int>((centroids[slot][axis] - centroid_bounds.min[axis]) * scale));
+        bins[bin].Grow(build_bounds[slot]);
+        ++bin_counts[bin];
+      }
+      // areas and counts on the right of every split, then a sweep from the left
+      float right_area[kBins];
+      std::size_t right_count[kBins];
+      Bounds right;
+      std::size_t right_total = 0;
+      for (int b = kBins - 1; b > 0; --b) {
+        right.Grow(bins[b]);
+        right_total += bin_counts[b];
+        right_area[b] = right.Area();
+        right_count[b] = right_total;
+      }
+      Bounds left;
+      std::size_t left_total = 0;
+      for (int b = 1; b < kBins; ++b) {
+        left.Grow(bins[b - 1]);
+        left_total += bin_counts[b - 1];
+        if (left_total == 0 || right_count[b] == 0) continue;
+        float cost = left.Area() * left_total + right_area[b] * right_count[b];
+        if (cost < best_cost) {
+          best_cost = cost;
+          best_axis = axis;
+          best_split = b;
+        }
+      }
+    }
+    std::size_t middle;
+    if (best_axis < 0) {
+      // too deep or all the centroids in the same point: the faces are split
+      // in half along the largest side
+      best_axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+      middle = first + count / 2;
+      std::nth_element(references.begin() + first, references.begin() + middle, references.begin() + first + count,
+                       [&](std::uint32_t a, std::uint32_t b) { return centroids[a][best_axis] < centroids[b][best_axis]; });
+    } else {
+      float scale = kBins / extent[best_axis];
+      float min = centroid_bounds.min[best_axis];
+      auto it = std::partition(references.begin() + first, references.begin() + first + count,
+                               [&](std::uint32_t reference) {
+                                 int bin = std::min(kBins - 1, static_cast<int>((centroids[reference][best_axis] - min) * scale));
+                                 return bin < best_split;
+                               });
+      middle = it - references.begin();
+    }
+    std::uint32_t children = node_count.fetch_add(2);
+    nodes[node_index].first = children;
+    nodes[node_index].count = 0;
+    nodes[node_index].axis = best_axis;
+    std::size_t left_count = middle - first;
+    std::size_t right_count = count - left_count;
+    if (left_count > kParallelBuild && right_count > kParallelBuild) {
+      TaskGroup group;
+      group.Run([=]() { BuildNode(children, first, left_count, depth + 1); });
+      BuildNode(children + 1, middle, right_count, depth + 1);
+      group.Wait();
+    } else {
+      BuildNode(children, first, left_count, depth + 1);
+      BuildNode(children + 1, middle, right_count, depth + 1);
+    }
+  }
+  void MakeLeaf(std::uint32_t node_index, std::size_t first, std::size_t count) {
+    std::uint32_t packet_index = packet_count.fetch_add(1);
+    TrianglePacket& packet = packets[packet_index];
+    for (std::uint32_t lane = 0; lane < 4; ++lane) {
+      packet.face[lane] = lane < count ? (*build_faces)[references[first + lane]]->index : -1;
+      packet.valid[lane] = 0.0f;
+    }
+    nodes[node_index].first = packet_index;
+    nodes[node_index].count = static_cast<std::uint32_t>(count);
+  }
+  static Bounds PacketBounds(const TrianglePacket& packet) {
+    Bounds bounds;
+    for (int lane = 0; lane < 4; ++lane) {
+      if (!packet.IsValid(lane)) continue;
+      for (int corner = 0; corner < 3; ++corner) {
+        bounds.Grow(packet.Corner(lane, corner));
+      }
+    }
+    return bounds;
+  }
+  // squared distance from p to the four triangles: the projection on the
+  // plane if it falls inside the triangle, otherwise the closest of the three
+  // sides. The empty lanes are at infinite distance
+  static Float4 TriangleDistanceSquared(const TrianglePacket& packet, const Vec3x4& p) {
+    Vec3x4 a = packet.V0(), e1 = packet.E1(), e2 = packet.E2();
+    Vec3x4 w = p - a;
+    Float4 d00 = Dot(e1, e1), d01 = Dot(e1, e2), d11 = Dot(e2, e2);
+    Float4 d20 = Dot(w, e1), d21 = Dot(w, e2);
+    Float4 denominator = d00 * d11 - d01 * d01;
+    Float4 s = (d11 * d20 - d01 * d21) / denominator;
+    Float4 t = (d00 * d21 - d01 * d20) / denominator;
+    Float4 inside = (s >= Float4(0.0f)) & (t >= Float4(0.0f)) & (s + t <= Float4(1.0f));
+    Vec3x4 normal = Cross(e1, e2);
+    Float4 plane = Dot(w, normal);
+    Float4 plane_distance = plane * plane / Dot(normal, normal);
+    Float4 sides = Min(SegmentDistanceSquared(w, e1),
+                       Min(SegmentDistanceSquared(w, e2), SegmentDistanceSquared(w - e1, e2 - e1)));
+    Float4 distance = Select(inside, plane_distance, sides);
+    return Select(Float4::Load(packet.valid), distance, Float4(std::numeric_limits<float>::infinity()));
+  }
+  // squared distance of the point w (relative to the start of the segment)
+  // from the segment with direction e
+  static Float4 SegmentDistanceSquared(const Vec3x4& w, const Vec3x4& e) {
+    Float4 t = Max(Min(Dot(w, e) / Dot(e, e), Float4(1.0f)), Float4(0.0f));
+    Vec3x4 d = w - e * t;
+    return Dot(d, d);
+  }
+  // closest point of the triangle abc to p (Ericson, Real-Time Collision Detection)
+  static glm::vec3 ClosestPointOnTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+    glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+    float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+    if (d1 <= 0.0f && d2 <= 0.0f) return a;
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    if (d3 >= 0.0f && d4 <= d3) return b;
+    float vc = d1 * d4 - d3 * d2;
+    if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) return a + ab * (d1 / (d1 - d3));
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    if (d6 >= 0.0f && d5 <= d6) return c;
+    float vb = d5 * d2 - d1 * d6;
+    if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) return a + ac * (d2 / (d2 - d6));
+    float va = d3 * d6 - d5 * d4;
+    if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) return b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    float denominator = 1.0f / (va + vb + vc);
+    return a + ab * (vb * denominator) + ac * (vc * denominator);
+  }
+
+  std::vector<Node> nodes;
+  std::vector<TrianglePacket> packets;
+  // faces of the mesh by HalfEdgeFace::index, nullptr for the removed ones
+  std::vector<HalfEdgeFace*> faces_by_index;
+  // build only
+  const std::vector<HalfEdgeFace*>* build_faces{nullptr};
+  std::vector<std::uint32_t> references;
+  std::vector<Bounds> build_bounds;
+  std::vector<glm::vec3> centroids;
+  std::atomic<std::uint32_t> node_count{0};
+  std::atomic<std::uint32_t> packet_count{0};
+};
+}  // namespace my_structs
@@ -0,0 +1,36 @@
+#pragma once
+#include <my_structs/mapped_file.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace my_structs {
+// 64 bit FNV-1a, used for the keys of the cache and the fingerprints of the
+// files of the snapshots
+class ContentHash {
+ public:
+  void Add(const void* data, std::size_t size) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+      hash = (hash ^ bytes[i]) * 1099511628211ull;
+    }
+  }
+  template <typename T>
+  void Add(const T& value) { Add(&value, sizeof(T)); }
+  void Add(const std::string& text) { Add(text.data(), text.size()); }
+  std::uint64_t Value() const { return hash; }
+ private:
+  std::uint64_t hash{14695981039346656037ull};
+};
+
+// hash of the size and of the bytes of a file, 0 if it can't be read
+inline std::uint64_t HashFileContent(const std::string& path) {
+  MappedFile file(path);
+  if (!file.IsOpen()) return 0;
+  ContentHash hash;
+  hash.Add(static_cast<std::uint64_t>(file.Size()));
+  hash.Add(file.Data(), file.Size());
+  return hash.Value();
+}
+}  // namespace my_structs
@@ -0,0 +1,107 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <set>
+#include <vector>
+
+namespace my_structs {
+// Priority queues of the QEM edges used by BasicMeshSimplification_QEM. Both
+// have the same interface: Push, Remove (nothing happens if the edge is not
+// in the queue), PopMin (nullptr when empty), Empty and Size
+
+// Exact order: the smallest error comes out first, the ties are broken by
+// the Comparator of the edge. O(log n) for every operation
+template <typename Edge>
+class ExactEdgeQueue {
+ public:
+  void Push(Edge* edge) { edges.insert(edge); }
+  void Remove(Edge* edge) {
+    auto it = edges.find(edge);
+    if (it != edges.end()) {
+      edges.erase(it);
+    }
+  }
+  Edge* PopMin() {
+    if (edges.empty()) return nullptr;
+    Edge* edge = *edges.begin();
+    edges.erase(edges.begin());
+    return edge;
+  }
+  bool Empty() const { return edges.empty(); }
+  std::size_t Size() const { return edges.size(); }
+
+ private:
+  std::set<Edge*, typename Edge::Comparator> edges;
+};
+
+// Approximate order: the errors are quantized on a logarithmic scale
+// (four buckets every time the error doubles) and the edges of
+// the same bucket come out in any order. Push, Remove and PopMin are O(1)
+// (PopMin moves forward over the empty buckets), the edges remember their
+// bucket and their position in it (queue_bucket and queue_position)
+template <typename Edge>
+class BucketEdgeQueue {
+ public:
+  // the errors below min_error all go in the first bucket
+  explicit BucketEdgeQueue(float min_error = 1e-12f) : min_key(Key(min_error)) {
+    buckets.resize(kMaxKey - min_key + 2);
+    lowest = buckets.size();
+  }
+  void Push(Edge* edge) {
+    std::size_t bucket = BucketOf(static_cast<float>(edge->qem));
+    edge->queue_bucket = static_cast<int>(bucket);
+    edge->queue_position = buckets[bucket].size();
+    buckets[bucket].push_back(edge);
+    lowest = std::min(lowest, bucket);
+    ++size;
+  }
+  void Remove(Edge* edge) {
+    if (edge->queue_bucket < 0) return;
+    std::vector<Edge*>& bucket = buckets[edge->queue_bucket];
+    // the last edge of the bucket takes the place of the removed one
+    Edge* last = bucket.back();
+    bucket[edge->queue_position] = last;
+    last->queue_position = edge->queue_position;
+    bucket.pop_back();
+    edge->queue_bucket = -1;
+    --size;
+  }
+  Edge* PopMin() {
+    while (lowest < buckets.size() && buckets[lowest].empty()) {
+      ++lowest;
+    }
+    if (lowest == buckets.size()) return nullptr;
+    Edge* edge = buckets[lowest].back();
+    buckets[lowest].pop_back();
+    edge->queue_bucket = -1;
+    --size;
+    return edge;
+  }
+  bool Empty() const { return size == 0; }
+  std::size_t Size() const { return size; }
+
+ private:
+  // 4 buckets for every power of two: the errors in a bucket differ by less than 19%
+  enum { kMantissaBits = 2 };
+  // key of the largest finite float
+  enum : std::uint32_t { kMaxKey = 0x7F7FFFFFu >> (23 - kMantissaBits) };
+  std::vector<std::vector<Edge*>> buckets;
+  std::uint32_t min_key;
+  std::size_t lowest;
+  std::size_t size{0};
+  // the bits of a positive float grow with its value, so the exponent and
+  // the first bits of the mantissa are a quantized log2 of the value
+  static std::uint32_t Key(float value) {
+    std::uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    return bits >> (23 - kMantissaBits);
+  }
+  std::size_t BucketOf(float error) const {
+    // negative errors (rounding) go in the first bucket, NaN and infinity in the last one
+    if (!(error > 0.0f)) return error == error ? 0 : buckets.size() - 1;
+    std::uint32_t key = std::min<std::uint32_t>(Key(error), kMaxKey + 1);
+    return key <= min_key ? 0 : key - min_key;
+  }
+};
+}  // namespace my_structs
@@ -0,0 +1,311 @@
+#pragma once
+#include <my_structs/halfedgedata.h>
+#include <my_structs/parallel.h>
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace my_structs {
+// Epoch-based reclamation: the readers pin the current epoch while they use
+// the shared data, the writer retires the old data with the epoch in which it
+// was replaced and frees it only when no reader is pinned on an older epoch
+class EpochManager {
+ public:
+  // a reader slot for every thread that reads at the same time
+  explicit EpochManager(std::size_t max_readers = 64) : slots(max_readers) {
+    for (auto& slot : slots) {
+      slot.store(kFree);
+    }
+  }
+  EpochManager(const EpochManager&) = delete;
+  EpochManager& operator=(const EpochManager&) = delete;
+  ~EpochManager() {
+    for (auto& item : retired) {
+      item.second();
+    }
+  }
+
+  // Keeps the epoch pinned until it is destroyed
+  class Guard {
+   public:
+    Guard(EpochManager* manager, std::size_t slot) : manager(manager), slot(slot) {}
+    Guard(Guard&& other) : manager(other.manager), slot(other.slot) { other.manager = nullptr; }
+    Guard(const Guard&) = delete;
+    Guard& operator=(const Guard&) = delete;
+    ~Guard() {
+      if (manager != nullptr) {
+        manager->slots[slot].store(kFree);
+      }
+    }
+   private:
+    EpochManager* manager;
+    std::size_t slot;
+  };
+
+  // Reader side: pins the current epoch, the data loaded after this call
+  // stays alive while the guard exists. Waits if all the slots are taken
+  Guard Pin() {
+    std::size_t start = std::hash<std::thread::id>()(std::this_thread::get_id()) % slots.size();
+    for (;;) {
+      for (std::size_t i = 0; i < slots.size(); ++i) {
+        std::size_t slot = (start + i) % slots.size();
+        std::uint64_t expected = kFree;
+        if (slots[slot].compare_exchange_strong(expected, epoch.load())) {
+          return Guard(this, slot);
+        }
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  std::uint64_t CurrentEpoch() const { return epoch.load(); }
+
+  // Writer side: the data was unlinked in the current epoch, deleter is
+  // called when no reader can still see it
+  void Retire(std::function<void()> deleter) {
+    std::lock_guard<std::mutex> lock(retired_mutex);
+    retired.push_back(std::make_pair(epoch.load(), std::move(deleter)));
+  }
+  // Writer side: starts a new epoch and frees what can be freed, returns
+  // the number of retired items that were freed
+  std::size_t Advance() {
+    epoch.fetch_add(1);
+    return Reclaim();
+  }
+  std::size_t Reclaim() {
+    std::uint64_t oldest = epoch.load();
+    for (auto& slot : slots) {
+      std::uint64_t pinned = slot.load();
+      if (pinned != kFree) {
+        oldest = std::min(oldest, pinned);
+      }
+    }
+    // the items retired in an epoch older than every pinned reader are unreachable
+    std::vector<std::function<void()>> to_free;
+    {
+      std::lock_guard<std::mutex> lock(retired_mutex);
+      auto it = std::partition(retired.begin(), retired.end(),
+                               [oldest](const std::pair<std::uint64_t, std::function<void()>>& item) {
+                                 return item.first >= oldest;
+                               });
+      for (auto free_it = it; free_it != retired.end(); ++free_it) {
+        to_free.push_back(std::move(free_it->second));
+      }
+      retired.erase(it, retired.end());
+    }
+    for (auto& deleter : to_free) {
+      deleter();
+    }
+    return to_free.size();
+  }
+  std::size_t RetiredCount() {
+    std::lock_guard<std::mutex> lock(retired_mutex);
+    return retired.size();
+  }
+
+ private:
+  // epochs start from 1, so 0 marks a free slot
+  static const std::uint64_t kFree = 0;
+  std::atomic<std::uint64_t> epoch{1};
+  std::vector<std::atomic<std::uint64_t>> slots;
+  std::mutex retired_mutex;
+  std::vector<std::pair<std::uint64_t, std::function<void()>>> retired;
+};
+
+// Slots of the faces of a snapshot, in blocks of kFaces slots. A block is
+// immutable once published: the next publish copies only the blocks with a
+// changed slot and shares the others with the previous snapshot
+struct MeshSnapshotBlock {
+  static const std::size_t kFaces = 512;
+  // three corners for every slot (in the order of the flat export)
+  glm::vec3 positions[kFaces * 3];
+  glm::vec3 normals[kFaces];
+  // face of the mesh in the slot, nullptr if the slot is empty. The removed
+  // faces are retired in the epoch, so the pointer identifies the face while
+  // the guard exists, but its fields belong to the writer
+  const HalfEdgeFace* faces[kFaces]{};
+};
+
+// Immutable faces of a HalfEdgeMesh published after a batch of collapses
+struct MeshEpochSnapshot {
+  std::uint64_t epoch{0};
+  std::vector<const MeshSnapshotBlock*> blocks;
+  std::size_t face_count{0};
+  std::size_t FaceCount() const { return face_count; }
+  // Calls fn(face, corners, normal) for every face, corners points to its
+  // three positions
+  template <typename Fn>
+  void ForEachFace(Fn fn) const {
+    for (auto block : blocks) {
+      for (std::size_t i = 0; i < MeshSnapshotBlock::kFaces; ++i) {
+        if (block->faces[i] != nullptr) {
+          fn(block->faces[i], &block->positions[i * 3], block->normals[i]);
+        }
+      }
+    }
+  }
+};
+
+// The simplification thread mutates the HalfEdgeMesh in place, so the other
+// threads never walk it: they pin an epoch and read the last published
+// snapshot, which stays valid until their guard is destroyed even if newer
+// snapshots are published. A publisher follows one mesh at a time: the mesh
+// records the faces changed after the last publish (see SnapshotChanges),
+// so a publish copies only them, and the removed faces and vertices are
+// retired with the replaced blocks
+class MeshSnapshotPublisher {
+ public:
+  explicit MeshSnapshotPublisher(std::size_t max_readers = 64) : epochs(max_readers) {}
+  MeshSnapshotPublisher(const MeshSnapshotPublisher&) = delete;
+  MeshSnapshotPublisher& operator=(const MeshSnapshotPublisher&) = delete;
+  ~MeshSnapshotPublisher() {
+    const MeshEpochSnapshot* snapshot = current.load();
+    if (snapshot != nullptr) {
+      for (auto block : snapshot->blocks) {
+        delete block;
+      }
+      delete snapshot;
+    }
+  }
+
+  class ReadGuard {
+   public:
+    ReadGuard(EpochManager::Guard guard, const MeshEpochSnapshot* snapshot)
+        : guard(std::move(guard)), snapshot(snapshot) {}
+    // nullptr if nothing was published yet
+    const MeshEpochSnapshot* operator->() const { return snapshot; }
+    const MeshEpochSnapshot* get() const { return snapshot; }
+   private:
+    EpochManager::Guard guard;
+    const MeshEpochSnapshot* snapshot;
+  };
+
+  // Reader side, the snapshot must not be used after the guard
+  ReadGuard Read() {
+    EpochManager::Guard guard = epochs.Pin();
+    return ReadGuard(std::move(guard), current.load());
+  }
+
+  // Writer side (a single writer, the thread that changes the mesh):
+  // publishes the faces changed after the last publish and retires the
+  // previous snapshot. The first publish of a mesh (or of another mesh)
+  // copies all its faces
+  void Publish(HalfEdgeMesh& mesh) {
+    SnapshotChanges& changes = mesh.snapshot_changes;
+    const MeshEpochSnapshot* previous = current.load();
+    MeshEpochSnapshot* snapshot = new MeshEpochSnapshot();
+    // blocks copied by this publish, indexed like snapshot->blocks
+    std::vector<MeshSnapshotBlock*> writable;
+    std::vector<const MeshSnapshotBlock*> replaced;
+    if (!changes.tracked || previous == nullptr || source != &mesh) {
+      // new slots for all the faces
+      if (previous != nullptr) {
+        replaced = previous->blocks;
+      }
+      source = &mesh;
+      free_slots.clear();
+      slot_count = 0;
+      changes.tracked = true;
+      changes.freed_slots.clear();
+      changes.dirty_faces.clear();
+      for (auto f : mesh.faces) {
+        f->snapshot_slot = -1;
+        f->snapshot_dirty = true;
+        changes.dirty_faces.push_back(f);
+      }
+    } else {
+      snapshot->blocks = previous->blocks;
+    }
+    writable.resize(snapshot->blocks.size(), nullptr);
+    auto write_block = [&](std::size_t slot) -> MeshSnapshotBlock* {
+      std::size_t b = slot / MeshSnapshotBlock::kFaces;
+      if (b >= snapshot->blocks.size()) {
+        snapshot->blocks.resize(b + 1, nullptr);
+        writable.resize(b + 1, nullptr);
+      }
+      if (writable[b] == nullptr) {
+        const MeshSnapshotBlock* old = snapshot->blocks[b];
+        writable[b] = old != nullptr ? new MeshSnapshotBlock(*old) : new MeshSnapshotBlock();
+        if (old != nullptr) {
+          replaced.push_back(old);
+        }
+        snapshot->blocks[b] = writable[b];
+      }
+      return writable[b];
+    };
+    for (auto slot : changes.freed_slots) {
+      write_block(slot)->faces[slot % MeshSnapshotBlock::kFaces] = nullptr;
+      free_slots.push_back(slot);
+    }
+    // the slots and the copies of the blocks are serial, the faces are
+    // written in parallel
+    for (auto f : changes.dirty_faces) {
+      if (f->snapshot_slot < 0) {
+        if (free_slots.empty()) {
+          f->snapshot_slot = static_cast<int>(slot_count++);
+        } else {
+          f->snapshot_slot = free_slots.back();
+          free_slots.pop_back();
+        }
+      }
+      write_block(f->snapshot_slot);
+    }
+    ParallelFor(0, changes.dirty_faces.size(), [&](std::size_t i) {
+      HalfEdgeFace* f = changes.dirty_faces[i];
+      MeshSnapshotBlock* block = writable[f->snapshot_slot / MeshSnapshotBlock::kFaces];
+      std::size_t k = f->snapshot_slot % MeshSnapshotBlock::kFaces;
+      block->positions[k * 3] = f->edge->next_edge->next_edge->v->position;
+      block->positions[k * 3 + 1] = f->edge->v->position;
+      block->positions[k * 3 + 2] = f->edge->next_edge->v->position;
+      block->normals[k] = mesh.FaceNormal(f);
+      block->faces[k] = f;
+      f->snapshot_dirty = false;
+    });
+    snapshot->face_count = mesh.faces.size();
+    snapshot->epoch = epochs.CurrentEpoch();
+    changes.dirty_faces.clear();
+    changes.freed_slots.clear();
+    current.store(snapshot);
+    // the readers pinned before this point may still see all of these
+    std::vector<HalfEdgeFace*> removed_faces;
+    std::vector<HalfEdgeVertex*> removed_vertices;
+    removed_faces.swap(changes.removed_faces);
+    removed_vertices.swap(changes.removed_vertices);
+    if (previous != nullptr || !removed_faces.empty() || !removed_vertices.empty()) {
+      epochs.Retire([previous, replaced = std::move(replaced), removed_faces = std::move(removed_faces),
+                     removed_vertices = std::move(removed_vertices)]() {
+        for (auto block : replaced) {
+          delete block;
+        }
+        delete previous;
+        for (auto face : removed_faces) {
+          delete face;
+        }
+        for (auto vertex : removed_vertices) {
+          delete vertex;
+        }
+      });
+    }
+    epochs.Advance();
+  }
+
+  EpochManager& Epochs() { return epochs; }
+
+ private:
+  EpochManager epochs;
+  std::atomic<const MeshEpochSnapshot*> current{nullptr};
+  // writer side: the mesh of the published slots, the empty slots and the
+  // number of slots used
+  const HalfEdgeMesh* source{nullptr};
+  std::vector<int> free_slots;
+  std::size_t slot_count{0};
+};
+}  // namespace my_structs
@@ -0,0 +1,138 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace my_structs {
+// Buffered sequential writer of fixed size records
+template <typename Record>
+class RecordWriter {
+ public:
+  RecordWriter(const std::string& path, std::size_t buffer_records = 1 << 16,
+               std::ios::openmode mode = std::ios::binary | std::ios::trunc)
+      : out(path, std::ios::out | mode) {
+    buffer.reserve(std::max<std::size_t>(1, buffer_records));
+  }
+  ~RecordWriter() { Flush(); }
+  bool IsOpen() const { return static_cast<bool>(out); }
+  void Write(const Record& record) {
+    buffer.push_back(record);
+    if (buffer.size() == buffer.capacity()) Flush();
+  }
+  void Flush() {
+    if (!buffer.empty()) {
+      out.write(reinterpret_cast<const char*>(buffer.data()), buffer.size() * sizeof(Record));
+      buffer.clear();
+    }
+    out.flush();
+  }
+  bool Good() const { return static_cast<bool>(out); }
+
+ private:
+  std::ofstream out;
+  std::vector<Record> buffer;
+};
+
+// Buffered sequential reader of fixed size records
+template <typename Record>
+class RecordReader {
+ public:
+  RecordReader(const std::string& path, std::size_t buffer_records = 1 << 16) : in(path, std::ios::binary) {
+    buffer.resize(std::max<std::size_t>(1, buffer_records));
+  }
+  bool IsOpen() const { return static_cast<bool>(in); }
+  // false at the end of the file
+  bool Next(Record& record) {
+    if (position == available) {
+      in.read(reinterpret_cast<char*>(buffer.data()), buffer.size() * sizeof(Record));
+      available = static_cast<std::size_t>(in.gcount()) / sizeof(Record);
+      position = 0;
+      if (available == 0) return false;
+    }
+    record = buffer[position++];
+    return true;
+  }
+
+ private:
+  std::ifstream in;
+  std::vector<Record> buffer;
+  std::size_t position{0};
+  std::size_t available{0};
+};
+
+// Sorts the records of the file input into the file output using at most
+// (about) memory_budget bytes: the input is split in runs that fit in the
+// budget, every run is sorted in memory and written next to output, then all
+// the runs are merged in a single pass. Returns false if a file can't be
+// opened
+template <typename Record, typename Less>
+bool ExternalSort(const std::string& input, const std::string& output, std::size_t memory_budget, Less less) {
+  std::size_t run_records = std::max<std::size_t>(1024, memory_budget / sizeof(Record));
+  RecordReader<Record> reader(input, std::min<std::size_t>(run_records, 1 << 16));
+  if (!reader.IsOpen()) return false;
+  std::vector<std::string> runs;
+  std::vector<Record> run;
+  run.reserve(run_records);
+  Record record;
+  bool more = true;
+  while (more) {
+    run.clear();
+    while (run.size() < run_records && (more = reader.Next(record))) {
+      run.push_back(record);
+    }
+    if (run.empty() && !runs.empty()) break;
+    std::sort(run.begin(), run.end(), less);
+    // a single run is the result
+    std::string path = !more && runs.empty() ? output : output + ".run" + std::to_string(runs.size());
+    RecordWriter<Record> writer(path);
+    if (!writer.IsOpen()) return false;
+    for (auto& item : run) {
+      writer.Write(item);
+    }
+    writer.Flush();
+    if (path == output) return writer.Good();
+    runs.push_back(path);
+  }
+  std::vector<Record>().swap(run);
+
+  // k-way merge, the budget is shared between the buffers of the runs
+  std::size_t buffer_records = std::max<std::size_t>(256, memory_budget / sizeof(Record) / (runs.size() + 1));
+  std::vector<std::unique_ptr<RecordReader<Record>>> readers;
+  std::vector<Record> heads(runs.size());
+  std::vector<std::size_t> heap;
+  for (std::size_t i = 0; i < runs.size(); ++i) {
+    readers.emplace_back(new RecordReader<Record>(runs[i], buffer_records));
+    if (readers[i]->Next(heads[i])) heap.push_back(i);
+  }
+  // min-heap of the runs by their head record (ties by run, so the sort is stable across runs)
+  auto greater = [&](std::size_t a, std::size_t b) {
+    if (less(heads[b], heads[a])) return true;
+    if (less(heads[a], heads[b])) return false;
+    return a > b;
+  };
+  std::make_heap(heap.begin(), heap.end(), greater);
+  {
+    RecordWriter<Record> writer(output, buffer_records);
+    if (!writer.IsOpen()) return false;
+    while (!heap.empty()) {
+      std::pop_heap(heap.begin(), heap.end(), greater);
+      std::size_t i = heap.back();
+      writer.Write(heads[i]);
+      if (readers[i]->Next(heads[i])) {
+        std::push_heap(heap.begin(), heap.end(), greater);
+      } else {
+        heap.pop_back();
+      }
+    }
+  }
+  readers.clear();
+  for (auto& path : runs) {
+    std::remove(path.c_str());
+  }
+  return true;
+}
+}  // namespace my_structs
@@ -0,0 +1,211 @@
+#pragma once
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <utility>
+#include <vector>
+
+namespace my_structs {
+// finalizer of MurmurHash3, every bit of the input changes half of the output
+inline std::uint64_t Mix64(std::uint64_t x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdULL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53ULL;
+  x ^= x >> 33;
+  return x;
+}
+inline std::uint64_t FloatBits(float value) {
+  // -0.0f and 0.0f are equal, so they must have the same hash
+  if (value == 0.0f) value = 0.0f;
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+// hash functions used by FlatHashMap
+template <typename Key>
+struct FlatHash {
+  std::uint64_t operator()(const Key& key) const {
+    return Mix64(static_cast<std::uint64_t>(std::hash<Key>{}(key)));
+  }
+};
+template <typename T>
+struct FlatHash<T*> {
+  std::uint64_t operator()(T* key) const {
+    return Mix64(static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(key)));
+  }
+};
+template <>
+struct FlatHash<std::uint64_t> {
+  std::uint64_t operator()(std::uint64_t key) const { return Mix64(key); }
+};
+template <>
+struct FlatHash<glm::vec3> {
+  std::uint64_t operator()(const glm::vec3& key) const {
+    std::uint64_t xy = FloatBits(key.x) | (FloatBits(key.y) << 32);
+    return Mix64(xy ^ Mix64(FloatBits(key.z) + 0x9e3779b97f4a7c15ULL));
+  }
+};
+template <>
+struct FlatHash<std::pair<glm::vec3, glm::vec3>> {
+  std::uint64_t operator()(const std::pair<glm::vec3, glm::vec3>& key) const {
+    FlatHash<glm::vec3> hash;
+    return Mix64(hash(key.first) ^ (hash(key.second) + 0x9e3779b97f4a7c15ULL));
+  }
+};
+// key of the edge between two vertex ids (see HalfEdgeVertex::id)
+inline std::uint64_t VertexPairKey(std::uint32_t from, std::uint32_t to) {
+  return (static_cast<std::uint64_t>(from) << 32) | to;
+}
+
+// Hash map with open addressing and linear probing: the entries are stored in
+// a single array, so a lookup costs one or two cache misses instead of the
+// pointer chase of the nodes of std::unordered_map. The capacity is a power
+// of two and the erased entries leave a tombstone.
+// N.B. the references to the values are invalidated by the insertions that
+// make the table grow (like std::vector)
+template <typename Key, typename Value, typename Hash = FlatHash<Key>,
+          typename Equal = std::equal_to<Key>>
+class FlatHashMap {
+ public:
+  using value_type = std::pair<Key, Value>;
+
+  template <typename Map, typename Entry>
+  class Iterator {
+   public:
+    Iterator(Map* map, std::size_t index) : map{map}, index{index} { SkipFree(); }
+    Entry& operator*() const { return map->entries[index]; }
+    Entry* operator->() const { return &map->entries[index]; }
+    Iterator& operator++() {
+      ++index;
+      SkipFree();
+      return *this;
+    }
+    bool operator==(const Iterator& other) const { return index == other.index; }
+    bool operator!=(const Iterator& other) const { return index != other.index; }
+   private:
+    void SkipFree() {
+      while (index < map->states.size() && map->states[index] != kFull) ++index;
+    }
+    Map* map;
+    std::size_t index;
+  };
+  using iterator = Iterator<FlatHashMap, value_type>;
+  using const_iterator = Iterator<const FlatHashMap, const value_type>;
+
+  FlatHashMap() = default;
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, states.size()); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, states.size()); }
+  std::size_t size() const { return count; }
+  bool empty() const { return count == 0; }
+
+  void clear() {
+    entries.clear();
+    states.clear();
+    count = 0;
+    used = 0;
+  }
+  void reserve(std::size_t elements) {
+    std::size_t capacity = 16;
+    while (capacity * kMaxLoadNum < elements * kMaxLoadDen) capacity *= 2;
+    if (capacity > states.size()) Rehash(capacity);
+  }
+  void swap(FlatHashMap& other) {
+    entries.swap(other.entries);
+    states.swap(other.states);
+    std::swap(count, other.count);
+    std::swap(used, other.used);
+  }
+
+  iterator find(const Key& key) {
+    std::size_t index = FindIndex(key);
+    return index == kNotFound ? end() : iterator(this, index);
+  }
+  const_iterator find(const Key& key) const {
+    std::size_t index = FindIndex(key);
+    return index == kNotFound ? end() : const_iterator(this, index);
+  }
+
+  std::pair<iterator, bool> insert(const value_type& entry) {
+    std::size_t index = FindIndex(entry.first);
+    if (index != kNotFound) return std::make_pair(iterator(this, index), false);
+    index = InsertNew(entry.first);
+    entries[index].second = entry.second;
+    return std::make_pair(iterator(this, index), true);
+  }
+  Value& operator[](const Key& key) {
+    std::size_t index = FindIndex(key);
+    if (index == kNotFound) index = InsertNew(key);
+    return entries[index].second;
+  }
+  std::size_t erase(const Key& key) {
+    std::size_t index = FindIndex(key);
+    if (index == kNotFound) return 0;
+    states[index] = kDeleted;
+    entries[index] = value_type();
+    --count;
+    return 1;
+  }
+
+ private:
+  // state of the entries
+  enum : std::uint8_t { kEmpty = 0, kFull = 1, kDeleted = 2 };
+  // maximum load factor 7/8 (tombstones included)
+  enum : std::size_t { kMaxLoadNum = 7, kMaxLoadDen = 8, kNotFound = static_cast<std::size_t>(-1) };
+
+  std::vector<value_type> entries;
+  std::vector<std::uint8_t> states;
+  // full entries and full + deleted entries
+  std::size_t count{0};
+  std::size_t used{0};
+
+  std::size_t FindIndex(const Key& key) const {
+    if (states.empty()) return kNotFound;
+    std::size_t mask = states.size() - 1;
+    std::size_t index = static_cast<std::size_t>(Hash{}(key)) & mask;
+    while (states[index] != kEmpty) {
+      if (states[index] == kFull && Equal{}(entries[index].first, key)) return index;
+      index = (index + 1) & mask;
+    }
+    return kNotFound;
+  }
+  // the key must not be in the map
+  std::size_t InsertNew(const Key& key) {
+    if (states.empty() || (used + 1) * kMaxLoadDen > states.size() * kMaxLoadNum) {
+      // if the table is full of tombstones it is cleaned without growing
+      Rehash(count * 2 * kMaxLoadDen > states.size() * kMaxLoadNum || states.empty()
+                 ? std::max<std::size_t>(16, states.size() * 2)
+                 : states.size());
+    }
+    std::size_t mask = states.size() - 1;
+    std::size_t index = static_cast<std::size_t>(Hash{}(key)) & mask;
+    while (states[index] == kFull) index = (index + 1) & mask;
+    if (states[index] == kEmpty) ++used;
+    states[index] = kFull;
+    entries[index].first = key;
+    ++count;
+    return index;
+  }
+  void Rehash(std::size_t capacity) {
+    std::vector<value_type> old_entries(capacity);
+    std::vector<std::uint8_t> old_states(capacity, static_cast<std::uint8_t>(kEmpty));
+    old_entries.swap(entries);
+    old_states.swap(states);
+    count = 0;
+    used = 0;
+    for (std::size_t i = 0; i < old_states.size(); ++i) {
+      if (old_states[i] == kFull) {
+        std::size_t index = InsertNew(old_entries[i].first);
+        entries[index].second = std::move(old_entries[i].second);
+      }
+    }
+  }
+};
+}  // namespace my_structs
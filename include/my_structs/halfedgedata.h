@@ -1,83 +1,134 @@
 #pragma once
-#include <glad/glad.h>
-#include <utils/mesh.h>
+#include <utils/vertex.h>
+#include <my_structs/parallel.h>
+#include <my_structs/welding.h>
+#include <my_structs/flat_hash_map.h>
 
 #include <glm/glm.hpp>
+#include <algorithm>
 #include <iostream>
-#include <unordered_map>
-#include <unordered_set>
 #include <vector>
 #include <cmath>
+#include <cstdint>
 
-namespace my_structs {
-// hash function for glm::vec3
-struct Vec3Hash {
-    std::size_t operator()(const glm::vec3& vertex) const {
-        std::size_t seed = 0;
-
-        // Combine the hash values of the position
-        seed ^= std::hash<float>{}(vertex.x) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        seed ^= std::hash<float>{}(vertex.y) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-        seed ^= std::hash<float>{}(vertex.z) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
+// defined in utils/mesh.h, with its OpenGL buffers
+class Mesh;
 
-        return seed;
-    }
-};
+namespace my_structs {
 bool operator==(const glm::vec3& lhs, const glm::vec3& rhs) {
     return lhs.x == rhs.x && lhs.y == rhs.y && lhs.z == rhs.z;
 }
-// hash function for std::pair<glm::vec3, glm::vec3>
-struct PairVec3Hash {
-  std::size_t operator()(const std::pair<glm::vec3, glm::vec3>& key) const {
-    // Compute the hash value based on the components of the glm::vec3 values
-    std::size_t seed = 0;
-    const glm::vec3& first = key.first;
-    const glm::vec3& second = key.second;
-
-    // Combine the hash values of the components using a simple hash function
-    // like the one below
-    seed ^=
-        std::hash<float>{}(first.x) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-    seed ^=
-        std::hash<float>{}(first.y) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-    seed ^=
-        std::hash<float>{}(first.z) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-    seed ^=
-        std::hash<float>{}(second.x) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-    seed ^=
-        std::hash<float>{}(second.y) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-    seed ^=
-        std::hash<float>{}(second.z) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-
-    return seed;
+// interleaves the bits of three 10 bits coordinates (Morton order / Z-order)
+inline std::uint32_t MortonCode(glm::vec3 position, glm::vec3 min, glm::vec3 max) {
+  glm::vec3 extent = glm::max(max - min, glm::vec3(1e-20f));
+  glm::vec3 normalized = glm::clamp((position - min) / extent, 0.0f, 1.0f);
+  std::uint32_t code = 0;
+  std::uint32_t x = static_cast<std::uint32_t>(normalized.x * 1023.0f);
+  std::uint32_t y = static_cast<std::uint32_t>(normalized.y * 1023.0f);
+  std::uint32_t z = static_cast<std::uint32_t>(normalized.z * 1023.0f);
+  for (int bit = 0; bit < 10; ++bit) {
+    code |= ((x >> bit) & 1u) << (3 * bit + 2);
+    code |= ((y >> bit) & 1u) << (3 * bit + 1);
+    code |= ((z >> bit) & 1u) << (3 * bit);
   }
-};
-bool operator==(const std::pair<glm::vec3, glm::vec3>& lhs, const std::pair<glm::vec3, glm::vec3>& rhs) {
-  // Compare the components of the glm::vec3 values for equality
-  return lhs.first == rhs.first && lhs.second == rhs.second;
+  return code;
 }
 
 class HalfEdge;
 class HalfEdgeFace;
 class HalfEdgeMesh;
 
+// result of the manifold check done when the mesh is built
+struct ManifoldReport {
+  // edges shared by more than two faces (or by two faces with the same orientation)
+  std::size_t non_manifold_edges{0};
+  // vertices with more than one fan of faces
+  std::size_t non_manifold_vertices{0};
+};
+
+// lightweight range to use the circulators in range-based for loops
+template <typename Iterator>
+class HalfEdgeRange {
+ public:
+  HalfEdgeRange(Iterator first, Iterator last) : first{first}, last{last} {};
+  Iterator begin() const { return first; }
+  Iterator end() const { return last; }
+ private:
+  Iterator first;
+  Iterator last;
+};
+// circulator over the edges around a vertex, it walks the fan through the
+// opposite edges without allocating anything. It stops when it comes back to
+// the first edge. If it reaches an edge without opposite (boundary) it sweeps
+// the other side of the fan from the first edge, so open fans cost O(valence)
+class VertexEdgeCirculator {
+ public:
+  VertexEdgeCirculator() = default;
+  VertexEdgeCirculator(HalfEdge* start, bool outgoing)
+      : start{start}, current{start}, outgoing{outgoing} {};
+  HalfEdge* operator*() const;
+  VertexEdgeCirculator& operator++();
+  bool operator!=(const VertexEdgeCirculator& other) const { return current != other.current; }
+  bool operator==(const VertexEdgeCirculator& other) const { return current == other.current; }
+ private:
+  HalfEdge* start{nullptr};
+  HalfEdge* current{nullptr};
+  bool outgoing{false};
+  bool backward{false};
+};
+// iterator over the three edges of a face
+class FaceEdgeIterator {
+ public:
+  FaceEdgeIterator(HalfEdge* current, int remaining)
+      : current{current}, remaining{remaining} {};
+  HalfEdge* operator*() const { return current; }
+  FaceEdgeIterator& operator++();
+  bool operator!=(const FaceEdgeIterator& other) const { return remaining != other.remaining; }
+  bool operator==(const FaceEdgeIterator& other) const { return remaining == other.remaining; }
+ private:
+  HalfEdge* current;
+  int remaining;
+};
+
 class HalfEdgeVertex {
  public:
   glm::vec3 position;
   glm::vec3 normal;
   HalfEdge* edge{nullptr};
+  // every face has its own vertices, the corners at the same position share
+  // the same id (it indexes the per-vertex arrays, e.g. the smooth normals)
+  int id{-1};
   HalfEdgeVertex(glm::vec3 position) : position{position} {};
   HalfEdgeVertex(glm::vec3 position, glm::vec3 normal)
       : position{position}, normal{normal} {};
   ~HalfEdgeVertex() = default;
-  std::vector<HalfEdge*> GetEdgesPointingToVertex(const HalfEdgeMesh* mesh);
+  std::vector<HalfEdge*> GetEdgesPointingToVertex() const;
+  // edges that have this vertex as destination, one for each face of the fan
+  HalfEdgeRange<VertexEdgeCirculator> IncomingEdges() const;
+  // edges that start from this vertex, one for each face of the fan
+  HalfEdgeRange<VertexEdgeCirculator> OutgoingEdges() const;
+  // true if the fan around the vertex is open (an edge without opposite)
+  bool IsBoundary() const;
+  // number of faces in the fan of the vertex
+  int Valence() const;
 };
 class HalfEdgeFace {
  public:
   HalfEdge* edge{nullptr};
+  // position of the face in the vertex buffer of the last flat export
+  int buffer_slot{-1};
+  // true if the face changed after the last export
+  bool dirty{false};
+  // position of the face in the per-face arrays (see FacePlanes)
+  int index{-1};
+  // position of the face in the epoch snapshots (see epoch.h) and true if
+  // it changed after the last publish
+  int snapshot_slot{-1};
+  bool snapshot_dirty{false};
   HalfEdgeFace(HalfEdge* edge) : edge{edge} {};
   ~HalfEdgeFace() = default;
   std::vector<HalfEdge*> GetEdges();
+  HalfEdgeRange<FaceEdgeIterator> Edges() const;
 };
 class HalfEdge {
  public:
@@ -95,33 +146,141 @@ std::vector<HalfEdge*> HalfEdgeFace::GetEdges() {
   edges.push_back(edge->next_edge->next_edge);
   return edges;
 }
+inline HalfEdgeRange<FaceEdgeIterator> HalfEdgeFace::Edges() const {
+  return HalfEdgeRange<FaceEdgeIterator>(FaceEdgeIterator(edge, 3), FaceEdgeIterator(nullptr, 0));
+}
+inline FaceEdgeIterator& FaceEdgeIterator::operator++() {
+  current = current->next_edge;
+  --remaining;
+  return *this;
+}
+inline HalfEdge* VertexEdgeCirculator::operator*() const {
+  return outgoing ? current->next_edge : current;
+}
+inline VertexEdgeCirculator& VertexEdgeCirculator::operator++() {
+  if (!backward) {
+    if (current->opposite_edge != nullptr) {
+      current = current->opposite_edge->next_edge->next_edge;
+      if (current == start) {
+        current = nullptr;
+      }
+      return *this;
+    }
+    // boundary reached, we go back to the first edge and turn the other way
+    backward = true;
+    current = start;
+  }
+  // the edge leaving the vertex in this face is opposite to the edge pointing
+  // to the vertex in the previous face
+  current = current->next_edge->opposite_edge;
+  if (current == start) {
+    current = nullptr;
+  }
+  return *this;
+}
+inline HalfEdgeRange<VertexEdgeCirculator> HalfEdgeVertex::IncomingEdges() const {
+  return HalfEdgeRange<VertexEdgeCirculator>(
+      VertexEdgeCirculator(edge->next_edge->next_edge, false), VertexEdgeCirculator());
+}
+inline HalfEdgeRange<VertexEdgeCirculator> HalfEdgeVertex::OutgoingEdges() const {
+  return HalfEdgeRange<VertexEdgeCirculator>(
+      VertexEdgeCirculator(edge->next_edge->next_edge, true), VertexEdgeCirculator());
+}
+inline int HalfEdgeVertex::Valence() const {
+  int valence = 0;
+  for (auto it = IncomingEdges().begin(); it != VertexEdgeCirculator(); ++it) {
+    ++valence;
+  }
+  return valence;
+}
+inline bool HalfEdgeVertex::IsBoundary() const {
+  HalfEdge* start = edge->next_edge->next_edge;
+  HalfEdge* current = start;
+  do {
+    if (current->opposite_edge == nullptr) {
+      return true;
+    }
+    current = current->opposite_edge->next_edge->next_edge;
+  } while (current != start);
+  return false;
+}
+
+// Plane (unit normal and offset d, normal.p + d = 0) and area of every face
+// in separate arrays indexed by HalfEdgeFace::index. The degenerate faces have
+// a zero normal and a zero area
+struct FacePlanes {
+  std::vector<glm::vec3> normals;
+  std::vector<float> offsets;
+  std::vector<float> areas;
+};
 
+// Changes of a mesh since its last epoch snapshot (see epoch.h), recorded
+// only while a publisher tracks the mesh. The removed faces and vertices are
+// kept here instead of being deleted: the publisher retires them in the
+// epoch, so the readers of the old snapshots never see them reused
+struct SnapshotChanges {
+  bool tracked{false};
+  std::vector<HalfEdgeFace*> dirty_faces;
+  std::vector<int> freed_slots;
+  std::vector<HalfEdgeFace*> removed_faces;
+  std::vector<HalfEdgeVertex*> removed_vertices;
+};
 class HalfEdgeMesh {
  public:
   std::vector<HalfEdgeVertex*> vertices;
   std::vector<HalfEdgeFace*> faces;
   std::vector<HalfEdge*> edges;
+  // number of vertex ids assigned when the mesh was built
+  std::size_t vertex_count{0};
+  ManifoldReport manifold_report;
+  // planes of the faces, kept up to date by ContractHalfEdge
+  FacePlanes face_planes;
+  SnapshotChanges snapshot_changes;
   HalfEdgeMesh() {
     vertices = std::vector<HalfEdgeVertex*>();
     faces = std::vector<HalfEdgeFace*>();
     edges = std::vector<HalfEdge*>();
   }
-  HalfEdgeMesh(const Mesh& mesh) {
-    std::vector<Vertex> all_vertices = mesh.vertices;
-    std::vector<GLuint> all_indices = mesh.indices;
-    for (int i = 0; i < all_indices.size(); i += 3) {
-      int index1 = all_indices[i];
-      int index2 = all_indices[i + 1];
-      int index3 = all_indices[i + 2];
+  // if weld_tolerance is greater than zero the vertices closer than the
+  // tolerance are welded before building the connectivity (see welding.h)
+  // from a Mesh (utils/mesh.h) or anything else with the vertices and indices buffers
+  template <typename MeshBuffers>
+  HalfEdgeMesh(const MeshBuffers& mesh, float weld_tolerance = 0.0f)
+      : HalfEdgeMesh(mesh.vertices, mesh.indices, weld_tolerance) {}
+  // from the buffers of a mesh, without a Mesh (and so without OpenGL)
+  HalfEdgeMesh(const std::vector<Vertex>& mesh_vertices, const std::vector<unsigned int>& mesh_indices,
+               float weld_tolerance = 0.0f) {
+    std::vector<Vertex> all_vertices = mesh_vertices;
+    std::vector<unsigned int> all_indices = mesh_indices;
+    if (weld_tolerance > 0.0f) {
+      std::size_t welded = WeldVertices(all_vertices, weld_tolerance);
+      if (welded > 0) {
+        std::cout << "HalfEdgeMesh: welded " << welded << " vertices" << std::endl;
+      }
+    }
+    for (std::size_t i = 0; i + 2 < all_indices.size(); i += 3) {
+      unsigned int index1 = all_indices[i];
+      unsigned int index2 = all_indices[i + 1];
+      unsigned int index3 = all_indices[i + 2];
       glm::vec3 v1 = all_vertices[index1].Position;
       glm::vec3 v2 = all_vertices[index2].Position;
       glm::vec3 v3 = all_vertices[index3].Position;
       glm::vec3 n1 = all_vertices[index1].Normal;
       glm::vec3 n2 = all_vertices[index2].Normal;
       glm::vec3 n3 = all_vertices[index3].Normal;
+      // degenerate triangles (e.g. created by the welding) can't be connected
+      if (v1 == v2 || v2 == v3 || v3 == v1) continue;
       AddFace(v1, v2, v3, n1, n2, n3);
     }
+    AssignVertexIds();
     ConnectAllEdges();
+    SplitNonManifoldVertices();
+    ComputeFacePlanes();
+    if (manifold_report.non_manifold_edges > 0 || manifold_report.non_manifold_vertices > 0) {
+      std::cout << "HalfEdgeMesh: split " << manifold_report.non_manifold_edges
+                << " non-manifold edges and " << manifold_report.non_manifold_vertices
+                << " non-manifold vertices" << std::endl;
+    }
   }
   ~HalfEdgeMesh() {
     for (auto vertex : vertices) {
@@ -133,10 +292,17 @@ class HalfEdgeMesh {
     for (auto edge : edges) {
       delete edge;
     }
+    // removed after the last publish, never retired
+    for (auto vertex : snapshot_changes.removed_vertices) {
+      delete vertex;
+    }
+    for (auto face : snapshot_changes.removed_faces) {
+      delete face;
+    }
   }
   void RemoveVertex(HalfEdgeVertex* v) {
     vertices.erase(std::remove(vertices.begin(), vertices.end(), v), vertices.end());
-    delete v;
+    DeleteVertex(v);
   }
   void RemoveEdge(HalfEdge* e) {
     if (e->opposite_edge != nullptr) {
@@ -148,94 +314,308 @@ class HalfEdgeMesh {
   }
   void RemoveFace(HalfEdgeFace* f) {
     faces.erase(std::remove(faces.begin(), faces.end(), f), faces.end());
+    if (f->buffer_slot >= 0) {
+      freed_slots.push_back(f->buffer_slot);
+    }
+    if (f->dirty) {
+      auto it = std::find(dirty_faces.begin(), dirty_faces.end(), f);
+      *it = dirty_faces.back();
+      dirty_faces.pop_back();
+    }
+    if (f->snapshot_slot >= 0) {
+      snapshot_changes.freed_slots.push_back(f->snapshot_slot);
+    }
+    if (f->snapshot_dirty) {
+      auto& snapshot_dirty = snapshot_changes.dirty_faces;
+      *std::find(snapshot_dirty.begin(), snapshot_dirty.end(), f) = snapshot_dirty.back();
+      snapshot_dirty.pop_back();
+    }
     f->edge = nullptr;
-    delete f;
+    DeleteFace(f);
+  }
+  const glm::vec3& FaceNormal(const HalfEdgeFace* f) const { return face_planes.normals[f->index]; }
+  float FaceOffset(const HalfEdgeFace* f) const { return face_planes.offsets[f->index]; }
+  float FaceArea(const HalfEdgeFace* f) const { return face_planes.areas[f->index]; }
+  // Numbers the faces in the order of faces and calculates all their planes
+  void ComputeFacePlanes() {
+    face_planes.normals.resize(faces.size());
+    face_planes.offsets.resize(faces.size());
+    face_planes.areas.resize(faces.size());
+    ParallelFor(0, faces.size(), [&](std::size_t i) {
+      faces[i]->index = static_cast<int>(i);
+      UpdateFacePlane(faces[i]);
+    });
+  }
+  void UpdateFacePlane(const HalfEdgeFace* f) {
+    glm::vec3 p1 = f->edge->next_edge->next_edge->v->position;
+    glm::vec3 p2 = f->edge->v->position;
+    glm::vec3 p3 = f->edge->next_edge->v->position;
+    glm::vec3 cross = glm::cross(p2 - p1, p3 - p1);
+    float length = glm::length(cross);
+    glm::vec3 normal = length > 0.0f ? cross / length : glm::vec3(0.0f);
+    if(std::isnan(normal.x) || std::isnan(normal.y) || std::isnan(normal.z)) {
+      normal = glm::vec3(0.0f, 0.0f, 0.0f);
+      length = 0.0f;
+    }
+    face_planes.normals[f->index] = normal;
+    face_planes.offsets[f->index] = -glm::dot(normal, p1);
+    face_planes.areas[f->index] = 0.5f * length;
   }
-  Mesh* ConvertToMesh(bool smooth_normals = false) {
+  void MarkFaceDirty(HalfEdgeFace* f) {
+    if (!f->dirty) {
+      f->dirty = true;
+      dirty_faces.push_back(f);
+    }
+    if (snapshot_changes.tracked && !f->snapshot_dirty) {
+      f->snapshot_dirty = true;
+      snapshot_changes.dirty_faces.push_back(f);
+    }
+  }
+  // the Mesh is a template parameter so that this header doesn't need
+  // OpenGL, it's instantiated only by the code that includes utils/mesh.h
+  template <typename MeshType = Mesh>
+  MeshType* ConvertToMesh(bool smooth_normals = false) {
     std::vector<Vertex> vertices_out;
-    std::vector<GLuint> indices_out;
-    std::unordered_map<glm::vec3, int, Vec3Hash> vertex_map;
+    std::vector<unsigned int> indices_out;
+    ConvertToBuffers(vertices_out, indices_out, smooth_normals);
+    return new MeshType(vertices_out, indices_out);
+  }
+  // the buffers of ConvertToMesh, without creating the Mesh
+  void ConvertToBuffers(std::vector<Vertex>& vertices_out, std::vector<unsigned int>& indices_out,
+                        bool smooth_normals = false) {
+    vertices_out.clear();
+    indices_out.clear();
     // Recalculate normals
     for (auto f : faces) {
       if(f->edge == nullptr) continue;
-      auto e1 = f->edge;
-      auto e2 = f->edge->next_edge;
-      auto e3 = f->edge->next_edge->next_edge;
-      glm::vec3 v1 = e3->v->position;
-      glm::vec3 v2 = e1->v->position;
-      glm::vec3 v3 = e2->v->position;
-      glm::vec3 normal = glm::normalize(glm::cross(v2 - v1, v3 - v1));
-      e1->v->normal = normal;
-      e2->v->normal = normal;
-      e3->v->normal = normal;
+      f->buffer_slot = -1;
+      f->dirty = false;
       if(!smooth_normals) {
-        vertices_out.push_back(Vertex{v1, normal});
-        vertices_out.push_back(Vertex{v2, normal});
-        vertices_out.push_back(Vertex{v3, normal});
+        f->buffer_slot = vertices_out.size() / 3;
+        vertices_out.resize(vertices_out.size() + 3);
+        WriteFlatFace(f, &vertices_out[vertices_out.size() - 3]);
         indices_out.push_back(vertices_out.size() - 3);
         indices_out.push_back(vertices_out.size() - 2);
         indices_out.push_back(vertices_out.size() - 1);
       }
     }
+    dirty_faces.clear();
+    freed_slots.clear();
+    exported_slots = smooth_normals ? 0 : faces.size();
+    dead_slots = 0;
     // Smooth normals with all the adjacent faces
     if(smooth_normals) {
-      std::unordered_set<glm::vec3, Vec3Hash> vertex_visited;
+      // one output vertex for every id, the first corner found is used to
+      // walk the fan of the vertex
+      std::vector<int> out_index(vertex_count, -1);
+      std::vector<HalfEdgeVertex*> representatives;
       for (auto v : vertices) {
-        auto it = vertex_visited.find(v->position);
-        if(it == vertex_visited.end()) {
-          std::vector<HalfEdge*> edges_to_vertex = v->GetEdgesPointingToVertex(this);
-          glm::vec3 normal = glm::vec3(0.0f);
-          for(auto edge : edges_to_vertex) {
-            normal += edge->v->normal;
-          }
-          normal /= edges_to_vertex.size();
-          normal = glm::normalize(normal);
-          if(std::isnan(normal.x) || std::isnan(normal.y) || std::isnan(normal.z)) {
-            normal = glm::vec3(0.0f, 0.0f, 0.0f);
-          }
-          vertex_visited.insert(v->position);
-          vertex_map[v->position] = vertices_out.size();
-          vertices_out.push_back(Vertex{v->position, normal});
+        if (out_index[v->id] < 0) {
+          out_index[v->id] = representatives.size();
+          representatives.push_back(v);
         }
       }
-      for (auto f : faces) {
-        if(f->edge == nullptr) continue;
-        auto e1 = f->edge;
-        auto e2 = f->edge->next_edge;
-        auto e3 = f->edge->next_edge->next_edge;
-        indices_out.push_back(vertex_map[e1->v->position]);
-        indices_out.push_back(vertex_map[e2->v->position]);
-        indices_out.push_back(vertex_map[e3->v->position]);
-      }
+      // the vertices gather the normals of their faces weighted by the area,
+      // so every vertex is written by
+      // a single thread and no buffers or atomics are needed
+      vertices_out.resize(representatives.size());
+      ParallelFor(0, representatives.size(), [&](std::size_t i) {
+        HalfEdgeVertex* v = representatives[i];
+        glm::vec3 normal = glm::vec3(0.0f);
+        for (auto edge : v->IncomingEdges()) {
+          normal += FaceNormal(edge->f) * FaceArea(edge->f);
+        }
+        normal = glm::normalize(normal);
+        if(std::isnan(normal.x) || std::isnan(normal.y) || std::isnan(normal.z)) {
+          normal = glm::vec3(0.0f, 0.0f, 0.0f);
+        }
+        vertices_out[i] = Vertex{v->position, normal};
+      });
+      indices_out.resize(faces.size() * 3);
+      ParallelFor(0, faces.size(), [&](std::size_t i) {
+        std::size_t corner = i * 3;
+        for (auto edge : faces[i]->Edges()) {
+          indices_out[corner++] = out_index[edge->v->id];
+        }
+      });
     }
-    return new Mesh(vertices_out, indices_out);
   }
-  std::vector<HalfEdge*> ContractHalfEdge(HalfEdge* e, glm::vec3 mergePos) {
+  // The returned vector is owned by the mesh and reused by the next call
+  const std::vector<HalfEdge*>& ContractHalfEdge(HalfEdge* e, glm::vec3 mergePos) {
     HalfEdgeVertex* v1 = e->next_edge->next_edge->v;
     HalfEdgeVertex* v2 = e->v;
+    int merged_id = v2->id;
 
-    std::vector<HalfEdge*> edges_to_v1 = v1->GetEdgesPointingToVertex(this);
-    std::vector<HalfEdge*> edges_to_v2 = v2->GetEdgesPointingToVertex(this);
+    // the fans are stored before the removal because the triangles are
+    // reconnected, the buffers keep their capacity between the collapses
+    edges_to_v1.clear();
+    edges_to_v2.clear();
+    for (auto edge : v1->IncomingEdges()) {
+      edges_to_v1.push_back(edge);
+    }
+    for (auto edge : v2->IncomingEdges()) {
+      edges_to_v2.push_back(edge);
+    }
 
     RemoveTriangleAndConnect(e);
     if (e->opposite_edge != nullptr && e->opposite_edge->f != nullptr) {
       RemoveTriangleAndConnect(e->opposite_edge);
     }
-    std::vector<HalfEdge*> edges_to_new_v = std::vector<HalfEdge*>();
+    edges_to_new_v.clear();
     for (auto edge : edges_to_v1) {
       if (edge->f != nullptr) {
         edge->v->position = mergePos;
+        edge->v->id = merged_id;
         edges_to_new_v.push_back(edge);
+        MarkFaceDirty(edge->f);
       }
     }
     for (auto edge : edges_to_v2) {
       if (edge->f != nullptr) {
         edge->v->position = mergePos;
+        edge->v->id = merged_id;
         edges_to_new_v.push_back(edge);
+        MarkFaceDirty(edge->f);
+      }
+    }
+    // only the faces around the new vertex moved
+    for (auto edge : edges_to_new_v) {
+      UpdateFacePlane(edge->f);
+    }
+    return edges_to_new_v;
+  }
+  // Checks if the edge can be contracted in mergePos without breaking the
+  // mesh: the two vertices must share only the vertices opposite to the edge
+  // (link condition), an inner edge can't join two boundaries and no face
+  // around the vertices can turn upside down. The neighbours are marked with
+  // stamps on the vertex ids, so it costs O(valence) and allocates nothing
+  bool IsCollapseValid(HalfEdge* e, glm::vec3 mergePos) {
+    HalfEdgeVertex* v1 = e->next_edge->next_edge->v;
+    HalfEdgeVertex* v2 = e->v;
+    HalfEdgeFace* f1 = e->f;
+    HalfEdgeFace* f2 = e->opposite_edge != nullptr ? e->opposite_edge->f : nullptr;
+    if (f2 != nullptr && v1->IsBoundary() && v2->IsBoundary()) {
+      return false;
+    }
+    if (vertex_stamps.size() < vertex_count) {
+      vertex_stamps.resize(vertex_count, 0);
+    }
+    // two new stamps: the neighbours of v1 and the shared neighbours already counted
+    if (stamp > UINT32_MAX - 2) {
+      std::fill(vertex_stamps.begin(), vertex_stamps.end(), 0);
+      stamp = 0;
+    }
+    std::uint32_t neighbour_stamp = ++stamp;
+    std::uint32_t counted_stamp = ++stamp;
+    for (auto edge : v1->IncomingEdges()) {
+      vertex_stamps[edge->next_edge->v->id] = neighbour_stamp;
+      vertex_stamps[edge->next_edge->next_edge->v->id] = neighbour_stamp;
+    }
+    int shared = 0;
+    for (auto edge : v2->IncomingEdges()) {
+      int ids[2] = {edge->next_edge->v->id, edge->next_edge->next_edge->v->id};
+      for (int id : ids) {
+        if (id != v1->id && id != v2->id && vertex_stamps[id] == neighbour_stamp) {
+          vertex_stamps[id] = counted_stamp;
+          ++shared;
+        }
+      }
+    }
+    if (shared != (f2 != nullptr ? 2 : 1)) {
+      return false;
+    }
+    // the opposite vertices of the removed faces: an inner one with valence 3
+    // would be left with two faces back to back, and if the edge between
+    // them already has v1 and v2 on its two sides (e.g. a tetrahedron) the
+    // collapse closes the surface on itself
+    HalfEdgeVertex* opposite1 = e->next_edge->v;
+    HalfEdgeVertex* opposite2 = f2 != nullptr ? e->opposite_edge->next_edge->v : nullptr;
+    for (auto opposite : {opposite1, opposite2}) {
+      if (opposite != nullptr && !opposite->IsBoundary() && opposite->Valence() <= 3) {
+        return false;
+      }
+    }
+    if (opposite2 != nullptr) {
+      int sides = 0;
+      for (auto edge : opposite1->IncomingEdges()) {
+        int next = edge->next_edge->v->id;
+        int previous = edge->next_edge->next_edge->v->id;
+        int third = next == opposite2->id ? previous : previous == opposite2->id ? next : -1;
+        if (third == v1->id || third == v2->id) {
+          ++sides;
+        }
       }
+      if (sides >= 2) {
+        return false;
+      }
+    }
+    // the faces that stay keep the orientation of their normal
+    return !FlipsFace(v1, f1, f2, mergePos) && !FlipsFace(v2, f1, f2, mergePos);
+  }
+  // Moves the fan of the vertex pointed by edge in position with the given
+  // id, no face is removed (used to join two vertices that don't share an
+  // edge). The returned vector is the same of ContractHalfEdge
+  const std::vector<HalfEdge*>& MoveVertex(HalfEdge* edge, glm::vec3 position, int id) {
+    edges_to_new_v.clear();
+    for (auto incoming : edge->v->IncomingEdges()) {
+      edges_to_new_v.push_back(incoming);
+    }
+    for (auto incoming : edges_to_new_v) {
+      incoming->v->position = position;
+      incoming->v->id = id;
+      MarkFaceDirty(incoming->f);
+    }
+    for (auto incoming : edges_to_new_v) {
+      UpdateFacePlane(incoming->f);
     }
     return edges_to_new_v;
   }
+  // true if no face of the fan of v turns upside down when v is moved in position
+  bool IsMoveValid(HalfEdgeVertex* v, glm::vec3 position) const {
+    return !FlipsFace(v, nullptr, nullptr, position);
+  }
+  // Patches the vertex buffer of a mesh created by ConvertToMesh(false) with
+  // the faces changed after that export: the moved faces are rewritten and the
+  // removed ones become degenerate triangles. Only the modified ranges are sent
+  // to the GPU. It returns false if the mesh must be rebuilt with
+  // ConvertToMesh (smooth normals or too many removed faces)
+  template <typename MeshType>
+  bool UpdateMesh(MeshType& mesh, bool smooth_normals = false) {
+    if (smooth_normals || exported_slots == 0 ||
+        mesh.vertices.size() != exported_slots * 3 ||
+        (dead_slots + freed_slots.size()) * 2 > exported_slots) {
+      return false;
+    }
+    updated_slots.clear();
+    for (auto f : dirty_faces) {
+      WriteFlatFace(f, &mesh.vertices[f->buffer_slot * 3]);
+      f->dirty = false;
+      updated_slots.push_back(f->buffer_slot);
+    }
+    for (auto slot : freed_slots) {
+      Vertex* out = &mesh.vertices[slot * 3];
+      out[1].Position = out[0].Position;
+      out[2].Position = out[0].Position;
+      updated_slots.push_back(slot);
+    }
+    dead_slots += freed_slots.size();
+    dirty_faces.clear();
+    freed_slots.clear();
+    // consecutive slots are sent with a single call
+    std::sort(updated_slots.begin(), updated_slots.end());
+    std::size_t i = 0;
+    while (i < updated_slots.size()) {
+      std::size_t j = i + 1;
+      while (j < updated_slots.size() && updated_slots[j] <= updated_slots[j - 1] + 1) {
+        ++j;
+      }
+      int first = updated_slots[i];
+      int count = updated_slots[j - 1] - first + 1;
+      mesh.UpdateVertices(first * 3, count * 3);
+      i = j;
+    }
+    return true;
+  }
   void RemoveTriangleAndConnect(HalfEdge* e1) {
     HalfEdge* e2 = e1->next_edge;
     HalfEdge* e3 = e2->next_edge;
@@ -249,8 +629,7 @@ class HalfEdgeMesh {
     }
   }
   void RemoveTriangle(HalfEdgeFace* f) {
-    std::vector<HalfEdge*> edges_face = f->GetEdges();
-    for (auto edge_to_remove : edges_face) {
+    for (auto edge_to_remove : f->Edges()) {
       // Remove vertex from vertices
       RemoveVertex(edge_to_remove->v);
       // Remove edge from edges
@@ -259,8 +638,186 @@ class HalfEdgeMesh {
     // Remove face from faces
     RemoveFace(f);
   }
+  // Reallocates faces, edges and vertices following the Morton order of the
+  // face centroids, so that the traversals walk the memory almost sequentially
+  // instead of jumping around the heap. All the pointers are remapped, if
+  // edge_remap is given it receives the pairs (old edge, new edge) so that
+  // the structures pointing to the edges can be updated
+  void ReorderByMortonCurve(std::vector<std::pair<HalfEdge*, HalfEdge*>>* edge_remap = nullptr) {
+    if (faces.empty()) return;
+    glm::vec3 min = faces[0]->edge->v->position;
+    glm::vec3 max = min;
+    for (auto v : vertices) {
+      min = glm::min(min, v->position);
+      max = glm::max(max, v->position);
+    }
+    std::vector<std::pair<std::uint32_t, HalfEdgeFace*>> order;
+    order.reserve(faces.size());
+    for (auto f : faces) {
+      glm::vec3 centroid = glm::vec3(0.0f);
+      for (auto e : f->Edges()) {
+        centroid += e->v->position;
+      }
+      order.push_back(std::make_pair(MortonCode(centroid / 3.0f, min, max), f));
+    }
+    std::sort(order.begin(), order.end(),
+              [](const std::pair<std::uint32_t, HalfEdgeFace*>& a,
+                 const std::pair<std::uint32_t, HalfEdgeFace*>& b) { return a.first < b.first; });
+
+    // every face is allocated together with its edges and its vertices
+    FlatHashMap<HalfEdge*, HalfEdge*> remap;
+    remap.reserve(edges.size());
+    std::vector<HalfEdgeVertex*> new_vertices;
+    std::vector<HalfEdgeFace*> new_faces;
+    std::vector<HalfEdge*> new_edges;
+    new_vertices.reserve(vertices.size());
+    new_faces.reserve(faces.size());
+    new_edges.reserve(edges.size());
+    for (auto& item : order) {
+      HalfEdgeFace* old_face = item.second;
+      HalfEdgeFace* face = new HalfEdgeFace(nullptr);
+      face->buffer_slot = old_face->buffer_slot;
+      face->dirty = old_face->dirty;
+      // the snapshots keep the slot, but the face is a new one
+      face->snapshot_slot = old_face->snapshot_slot;
+      face->snapshot_dirty = snapshot_changes.tracked;
+      new_faces.push_back(face);
+      for (auto old_edge : old_face->Edges()) {
+        HalfEdge* edge = new HalfEdge(nullptr);
+        edge->f = face;
+        remap[old_edge] = edge;
+        new_edges.push_back(edge);
+      }
+      for (auto old_edge : old_face->Edges()) {
+        HalfEdgeVertex* vertex = new HalfEdgeVertex(old_edge->v->position, old_edge->v->normal);
+        vertex->id = old_edge->v->id;
+        remap[old_edge]->v = vertex;
+        new_vertices.push_back(vertex);
+      }
+    }
+    for (auto& item : order) {
+      HalfEdgeFace* old_face = item.second;
+      HalfEdgeFace* face = remap[old_face->edge]->f;
+      face->edge = remap[old_face->edge];
+      for (auto old_edge : old_face->Edges()) {
+        HalfEdge* edge = remap[old_edge];
+        edge->next_edge = remap[old_edge->next_edge];
+        if (old_edge->opposite_edge != nullptr) {
+          edge->opposite_edge = remap[old_edge->opposite_edge];
+        }
+        edge->v->edge = remap[old_edge->v->edge];
+      }
+    }
+    if (edge_remap != nullptr) {
+      edge_remap->clear();
+      edge_remap->reserve(remap.size());
+      for (auto& item : remap) {
+        edge_remap->push_back(item);
+      }
+    }
+    for (auto vertex : vertices) {
+      DeleteVertex(vertex);
+    }
+    for (auto face : faces) {
+      DeleteFace(face);
+    }
+    for (auto edge : edges) {
+      delete edge;
+    }
+    vertices.swap(new_vertices);
+    faces.swap(new_faces);
+    edges.swap(new_edges);
+    dirty_faces.clear();
+    snapshot_changes.dirty_faces.clear();
+    for (auto f : faces) {
+      if (f->dirty) {
+        dirty_faces.push_back(f);
+      }
+      if (f->snapshot_dirty) {
+        snapshot_changes.dirty_faces.push_back(f);
+      }
+    }
+    ComputeFacePlanes();
+  }
 
  private:
+  // faces changed and buffer slots freed after the last export
+  std::vector<HalfEdgeFace*> dirty_faces;
+  std::vector<int> freed_slots;
+  std::vector<int> updated_slots;
+  std::size_t exported_slots{0};
+  std::size_t dead_slots{0};
+  // scratch buffers of ContractHalfEdge
+  std::vector<HalfEdge*> edges_to_v1;
+  std::vector<HalfEdge*> edges_to_v2;
+  std::vector<HalfEdge*> edges_to_new_v;
+  // the snapshots may still show the removed elements, their publisher
+  // deletes them (see SnapshotChanges)
+  void DeleteVertex(HalfEdgeVertex* v) {
+    if (snapshot_changes.tracked) {
+      snapshot_changes.removed_vertices.push_back(v);
+    } else {
+      delete v;
+    }
+  }
+  void DeleteFace(HalfEdgeFace* f) {
+    if (snapshot_changes.tracked) {
+      snapshot_changes.removed_faces.push_back(f);
+    } else {
+      delete f;
+    }
+  }
+  // stamps of IsCollapseValid, indexed by vertex id
+  std::vector<std::uint32_t> vertex_stamps;
+  std::uint32_t stamp{0};
+  // true if a face of the fan of v (apart from the removed f1 and f2) gets
+  // the opposite normal when v is moved in position
+  bool FlipsFace(HalfEdgeVertex* v, HalfEdgeFace* f1, HalfEdgeFace* f2, glm::vec3 position) const {
+    for (auto edge : v->IncomingEdges()) {
+      if (edge->f == f1 || edge->f == f2 || FaceArea(edge->f) <= 0.0f) {
+        continue;
+      }
+      glm::vec3 previous = edge->next_edge->next_edge->v->position;
+      glm::vec3 next = edge->next_edge->v->position;
+      glm::vec3 normal = glm::cross(position - previous, next - previous);
+      if (glm::dot(normal, FaceNormal(edge->f)) <= 0.0f) {
+        return true;
+      }
+    }
+    return false;
+  }
+  // Copies the cached normal of the face on its corners and writes its three
+  // vertices in out (if not null) in the order used by the flat export
+  void WriteFlatFace(HalfEdgeFace* f, Vertex* out) {
+    auto e1 = f->edge;
+    auto e2 = f->edge->next_edge;
+    auto e3 = f->edge->next_edge->next_edge;
+    glm::vec3 v1 = e3->v->position;
+    glm::vec3 v2 = e1->v->position;
+    glm::vec3 v3 = e2->v->position;
+    glm::vec3 normal = FaceNormal(f);
+    e1->v->normal = normal;
+    e2->v->normal = normal;
+    e3->v->normal = normal;
+    if (out != nullptr) {
+      out[0] = Vertex{v1, normal};
+      out[1] = Vertex{v2, normal};
+      out[2] = Vertex{v3, normal};
+    }
+  }
+  // the corners with the same position get the same id
+  void AssignVertexIds() {
+    FlatHashMap<glm::vec3, int> ids;
+    ids.reserve(vertices.size());
+    for (auto v : vertices) {
+      auto it = ids.find(v->position);
+      if (it == ids.end()) {
+        it = ids.insert(std::make_pair(v->position, static_cast<int>(ids.size()))).first;
+      }
+      v->id = it->second;
+    }
+    vertex_count = ids.size();
+  }
   void AddFace(glm::vec3 v1, glm::vec3 v2, glm::vec3 v3, glm::vec3 n1,
                glm::vec3 n2, glm::vec3 n3) {
     HalfEdgeVertex* vertex1 = new HalfEdgeVertex(v1, n1);
@@ -287,56 +844,96 @@ class HalfEdgeMesh {
     edges.push_back(edge3);
     faces.push_back(face);
   }
+  // the edges are paired through the ids of their vertices, so the vertex ids
+  // must be assigned before. Every edge is paired only once: the half-edges
+  // that arrive when the edge already has two faces (or that have the same
+  // direction of a waiting half-edge) are left without opposite, so the
+  // faces around a non-manifold edge are split in manifold sheets
   void ConnectAllEdges() {
-    std::unordered_map<std::pair<glm::vec3, glm::vec3>, HalfEdge*, PairVec3Hash>
-        edges_map;
-    /*for (auto edge : edges) {
-      if (edge->opposite_edge != nullptr) continue;
-      edges_map[std::make_pair(edge->next_edge->next_edge->v->position,
-                               edge->v->position)] = edge;
-    }
+    struct EdgeSlot {
+      // half-edge waiting for its opposite, nullptr when the edge is complete
+      HalfEdge* waiting{nullptr};
+      bool non_manifold{false};
+    };
+    FlatHashMap<std::uint64_t, EdgeSlot> edges_map;
+    edges_map.reserve(edges.size());
     for (auto edge : edges) {
-      if (edge->opposite_edge != nullptr) continue;
-      HalfEdge* eOther = edges_map[std::make_pair(
-          edge->v->position, edge->next_edge->next_edge->v->position)];
-      if (eOther != nullptr) {
-        edge->opposite_edge = eOther;
-        eOther->opposite_edge = edge;
-      } else {
-        std::cout << "ConnectAllEdges: eOther == nullptr" << std::endl;
+      std::uint32_t from = edge->next_edge->next_edge->v->id;
+      std::uint32_t to = edge->v->id;
+      auto it = edges_map.find(VertexPairKey(to, from));
+      if (it != edges_map.end() && it->second.waiting != nullptr) {
+        it->second.waiting->opposite_edge = edge;
+        edge->opposite_edge = it->second.waiting;
+        it->second.waiting = nullptr;
+        continue;
       }
-    }*/
-    for (auto edge : edges) {
-      auto it = edges_map.find(std::make_pair(edge->v->position, edge->next_edge->next_edge->v->position));
       if (it == edges_map.end()) {
-        edges_map[std::make_pair(edge->next_edge->next_edge->v->position,
-                                 edge->v->position)] = edge;
-      } else {
-        it->second->opposite_edge = edge;
-        edge->opposite_edge = it->second;
+        it = edges_map.find(VertexPairKey(from, to));
+        if (it == edges_map.end()) {
+          edges_map[VertexPairKey(from, to)].waiting = edge;
+          continue;
+        }
+      }
+      // the edge already has two faces or a face with the same orientation
+      if (!it->second.non_manifold) {
+        it->second.non_manifold = true;
+        ++manifold_report.non_manifold_edges;
       }
     }
   }
+  // A vertex with more than one fan (e.g. two cones touching at the apex, or
+  // the fans left by the split of the non-manifold edges) is split: the first
+  // fan keeps the id and every other fan gets a new one
+  void SplitNonManifoldVertices() {
+    // every corner belongs to exactly one fan, so if the fan of the first
+    // corner is smaller than the number of corners there are other fans
+    std::vector<int> corners(vertex_count, 0);
+    std::vector<int> first_fan(vertex_count, -1);
+    for (auto v : vertices) {
+      ++corners[v->id];
+    }
+    std::vector<int> non_manifold_ids;
+    for (auto v : vertices) {
+      if (first_fan[v->id] >= 0) continue;
+      first_fan[v->id] = v->Valence();
+      if (first_fan[v->id] < corners[v->id]) {
+        non_manifold_ids.push_back(v->id);
+      }
+    }
+    if (non_manifold_ids.empty()) return;
+    manifold_report.non_manifold_vertices = non_manifold_ids.size();
+    FlatHashMap<std::uint64_t, std::vector<HalfEdgeVertex*>> groups;
+    for (auto id : non_manifold_ids) {
+      groups[id] = std::vector<HalfEdgeVertex*>();
+    }
+    for (auto v : vertices) {
+      auto it = groups.find(v->id);
+      if (it != groups.end()) {
+        it->second.push_back(v);
+      }
+    }
+    FlatHashMap<HalfEdgeVertex*, bool> assigned;
+    for (auto& group : groups) {
+      bool first = true;
+      for (auto v : group.second) {
+        if (assigned.find(v) != assigned.end()) continue;
+        int id = first ? v->id : static_cast<int>(vertex_count++);
+        first = false;
+        for (auto edge : v->IncomingEdges()) {
+          edge->v->id = id;
+          assigned[edge->v] = true;
+        }
+      }
+    }
+  }
+
+
 };
 
-std::vector<HalfEdge*> HalfEdgeVertex::GetEdgesPointingToVertex(const HalfEdgeMesh* mesh) {
+inline std::vector<HalfEdge*> HalfEdgeVertex::GetEdgesPointingToVertex() const {
   std::vector<HalfEdge*> edges;
-  HalfEdge* current = edge->next_edge->next_edge;
-  do {
+  for (auto current : IncomingEdges()) {
     edges.push_back(current);
-    if(current->opposite_edge == nullptr) {
-      std::cout << "Opposite edge is null" << std::endl;
-      edges.clear();
-      break;
-    }
-    current = current->opposite_edge->next_edge->next_edge;
-  } while (current->next_edge != edge);
-  if(edges.size() == 0 && mesh != nullptr) {
-    for(auto edge : mesh->edges) {
-      if(edge->v->position == this->position) {
-        edges.push_back(edge);
-      }
-    }
   }
   return edges;
 }
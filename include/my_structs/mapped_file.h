@@ -0,0 +1,54 @@
+#pragma once
+#include <cstddef>
+#include <string>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace my_structs {
+// Read-only memory mapping of a whole file
+class MappedFile {
+ public:
+#ifdef _WIN32
+  // on Windows the mapping is in src/mapped_file.cpp: <windows.h> must not
+  // reach app.cpp, where it clashes with the APIENTRY of glad
+  MappedFile(const std::string& path);
+  ~MappedFile();
+#else
+  MappedFile(const std::string& path) {
+    file = open(path.c_str(), O_RDONLY);
+    if (file < 0) return;
+    struct stat info;
+    if (fstat(file, &info) != 0 || info.st_size == 0) return;
+    void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+    if (address == MAP_FAILED) return;
+    data = static_cast<const unsigned char*>(address);
+    size = static_cast<std::size_t>(info.st_size);
+  }
+  ~MappedFile() {
+    if (data != nullptr) munmap(const_cast<unsigned char*>(data), size);
+    if (file >= 0) close(file);
+  }
+#endif
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+  bool IsOpen() const { return data != nullptr; }
+  const unsigned char* Data() const { return data; }
+  std::size_t Size() const { return size; }
+
+ private:
+  const unsigned char* data{nullptr};
+  std::size_t size{0};
+#ifdef _WIN32
+  // the HANDLEs of the file and of the mapping (nullptr if not open)
+  void* file{nullptr};
+  void* mapping{nullptr};
+#else
+  int file{-1};
+#endif
+};
+}  // namespace my_structs
@@ -0,0 +1,48 @@
+#pragma once
+#include <my_structs/halfedgedata.h>
+#include <my_structs/bvh.h>
+#include <my_structs/parallel.h>
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace my_structs {
+// distances of the vertices of a mesh from the surface of another one
+struct SurfaceDistance {
+  // the largest distance (one-sided Hausdorff distance measured at the vertices)
+  float max{0.0f};
+  // root mean square of the distances
+  float rms{0.0f};
+};
+
+// Distances of the vertices of from (one for every vertex id) from the faces
+// of the tree, e.g. the simplified mesh against the original one and the other
+// way around for the symmetric Hausdorff distance
+inline SurfaceDistance VertexDistance(const HalfEdgeMesh& from, const FaceBVH& to) {
+  SurfaceDistance result;
+  // one corner for every id
+  std::vector<const HalfEdgeVertex*> representatives(from.vertex_count, nullptr);
+  for (auto v : from.vertices) {
+    representatives[v->id] = v;
+  }
+  std::vector<float> distances(representatives.size(), 0.0f);
+  ParallelFor(0, representatives.size(), [&](std::size_t i) {
+    ClosestPointHit hit;
+    if (representatives[i] != nullptr && to.ClosestPoint(representatives[i]->position, hit)) {
+      distances[i] = hit.distance;
+    }
+  }, 256);
+  double sum = 0.0;
+  std::size_t count = 0;
+  for (std::size_t i = 0; i < distances.size(); ++i) {
+    if (representatives[i] == nullptr) continue;
+    result.max = std::max(result.max, distances[i]);
+    sum += static_cast<double>(distances[i]) * distances[i];
+    ++count;
+  }
+  result.rms = count > 0 ? static_cast<float>(std::sqrt(sum / count)) : 0.0f;
+  return result;
+}
+}  // namespace my_structs
@@ -0,0 +1,113 @@
+#pragma once
+#include <my_structs/epoch.h>
+#include <my_structs/halfedgedata.h>
+#include <my_structs/simplification.h>
+#include <my_structs/parallel.h>
+#include <utils/model.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <vector>
+
+namespace my_structs {
+// Half-edge mesh and QEM simplification for every mesh of a Model. The parts
+// are built and simplified in parallel and the triangle budget of the whole
+// model is shared between the parts by error: at each round the parts
+// collapse only the edges below a common error threshold, so the parts with
+// cheap collapses give more triangles than the detailed ones. Every part is
+// published after each round (see epoch.h), so other threads can read the
+// parts while they are simplified
+class ModelSimplifier {
+ public:
+  ModelSimplifier(const Model& model, float weld_tolerance = 0.0f) : parts(model.meshes.size()) {
+    ParallelFor(0, parts.size(), [&](std::size_t i) {
+      parts[i].mesh.reset(new HalfEdgeMesh(model.meshes[i], weld_tolerance));
+      parts[i].mesh->ReorderByMortonCurve();
+      parts[i].simplification.reset(new MeshSimplification_QEM(*parts[i].mesh));
+      parts[i].snapshots.reset(new MeshSnapshotPublisher());
+      parts[i].snapshots->Publish(*parts[i].mesh);
+    }, 1);
+  }
+  std::size_t PartCount() const { return parts.size(); }
+  HalfEdgeMesh& PartMesh(std::size_t i) { return *parts[i].mesh; }
+  // last published snapshot of the part, for the threads that don't simplify
+  MeshSnapshotPublisher::ReadGuard ReadPart(std::size_t i) { return parts[i].snapshots->Read(); }
+  std::size_t FaceCount() const {
+    std::size_t count = 0;
+    for (auto& part : parts) {
+      count += part.mesh->faces.size();
+    }
+    return count;
+  }
+  // Collapses edges until the whole model has at most max_faces faces.
+  // Returns false if the budget can't be reached without collapsing an edge
+  // with error greater than max_error, or if no part can collapse an edge
+  bool Simplify(std::size_t max_faces, float max_error) {
+    float threshold = -std::numeric_limits<float>::infinity();
+    while (FaceCount() > max_faces) {
+      float min_error = std::numeric_limits<float>::infinity();
+      for (auto& part : parts) {
+        min_error = std::min(min_error, NextError(part));
+      }
+      // with max_error infinite, infinity means that no part has an edge left
+      if (min_error > max_error || std::isinf(min_error)) {
+        return false;
+      }
+      // the threshold grows geometrically, but at least the part with the
+      // smallest error can always collapse one edge
+      threshold = std::min(max_error, std::max(threshold * 2.0f, min_error));
+      std::size_t faces = FaceCount();
+      std::size_t excess = faces - max_faces;
+      ParallelFor(0, parts.size(), [&](std::size_t i) {
+        Part& part = parts[i];
+        // share of the excess proportional to the size of the part, a
+        // collapse removes two faces
+        std::size_t collapses = std::max<std::size_t>(1, excess * part.mesh->faces.size() / faces / 2);
+        for (std::size_t c = 0; c < collapses && NextError(part) <= threshold; ++c) {
+          part.simplification->SimplifyMesh(1, threshold);
+        }
+        part.snapshots->Publish(*part.mesh);
+      }, 1);
+      // a round without collapses would be repeated forever
+      if (FaceCount() == faces) {
+        return false;
+      }
+    }
+    return true;
+  }
+  // Model with one mesh for every part (the GPU buffers are created here, so
+  // it must be called on the thread of the OpenGL context)
+  Model BuildModel(bool smooth) {
+    Model model;
+    model.meshes.reserve(parts.size());
+    for (auto& part : parts) {
+      part.simplification->ReorderMesh();
+      part.snapshots->Publish(*part.mesh);
+      Mesh* mesh = part.mesh->ConvertToMesh(smooth);
+      model.meshes.push_back(std::move(*mesh));
+      delete mesh;
+    }
+    return model;
+  }
+
+ private:
+  struct Part {
+    std::unique_ptr<HalfEdgeMesh> mesh;
+    // declared after the mesh because it keeps a reference to it
+    std::unique_ptr<MeshSimplification_QEM> simplification;
+    std::unique_ptr<MeshSnapshotPublisher> snapshots;
+  };
+  // error of the next collapse of the part, infinity if the part can't be simplified more
+  static float NextError(const Part& part) {
+    if (part.mesh->faces.size() <= 5 || part.simplification->Exhausted()) {
+      return std::numeric_limits<float>::infinity();
+    }
+    return part.simplification->smallest_error_edge->qem;
+  }
+  std::vector<Part> parts;
+};
+}  // namespace my_structs
@@ -0,0 +1,76 @@
+#pragma once
+#include <utils/vertex.h>
+
+#include <glm/glm.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace my_structs {
+// Reads the positions and the faces of an OBJ file in memory (the polygons
+// are split in fans, the normals and the texture coordinates are ignored),
+// without Assimp and OpenGL. The vertices are the positions of the file, so
+// the faces share them. It returns false if the file can't be read. For the
+// files too large for the memory see ObjTriangleSource in streaming.h
+inline bool ReadObj(const std::string& path, std::vector<Vertex>& vertices, std::vector<unsigned int>& indices) {
+  std::ifstream in(path);
+  if (!in) return false;
+  vertices.clear();
+  indices.clear();
+  std::vector<unsigned int> polygon;
+  std::string line;
+  while (std::getline(in, line)) {
+    if (line.size() > 2 && line[0] == 'v' && line[1] == ' ') {
+      Vertex vertex{};
+      std::sscanf(line.c_str() + 2, "%f %f %f", &vertex.Position.x, &vertex.Position.y, &vertex.Position.z);
+      vertices.push_back(vertex);
+    } else if (line.size() > 2 && line[0] == 'f' && line[1] == ' ') {
+      // the corners are "v", "v/vt", "v//vn" or "v/vt/vn", negative indices
+      // count from the last position read
+      polygon.clear();
+      std::istringstream corners_in(line.substr(2));
+      std::string corner;
+      while (corners_in >> corner) {
+        long index = std::strtol(corner.c_str(), nullptr, 10);
+        if (index < 0) index += static_cast<long>(vertices.size()) + 1;
+        if (index <= 0 || static_cast<std::size_t>(index) > vertices.size()) break;
+        polygon.push_back(static_cast<unsigned int>(index - 1));
+      }
+      for (std::size_t i = 2; i < polygon.size(); ++i) {
+        indices.push_back(polygon[0]);
+        indices.push_back(polygon[i - 1]);
+        indices.push_back(polygon[i]);
+      }
+    }
+  }
+  return true;
+}
+
+// Writes the positions, the normals (if normals is true) and the triangles
+// in an OBJ file, it returns false if the file can't be written
+inline bool WriteObj(const std::string& path, const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices,
+                     bool normals = true) {
+  FILE* out = std::fopen(path.c_str(), "w");
+  if (out == nullptr) return false;
+  for (auto& vertex : vertices) {
+    std::fprintf(out, "v %.9g %.9g %.9g\n", vertex.Position.x, vertex.Position.y, vertex.Position.z);
+  }
+  if (normals) {
+    for (auto& vertex : vertices) {
+      std::fprintf(out, "vn %.6f %.6f %.6f\n", vertex.Normal.x, vertex.Normal.y, vertex.Normal.z);
+    }
+  }
+  for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+    unsigned int a = indices[i] + 1, b = indices[i + 1] + 1, c = indices[i + 2] + 1;
+    if (normals) {
+      std::fprintf(out, "f %u//%u %u//%u %u//%u\n", a, a, b, b, c, c);
+    } else {
+      std::fprintf(out, "f %u %u %u\n", a, b, c);
+    }
+  }
+  return std::fclose(out) == 0;
+}
+}  // namespace my_structs
@@ -0,0 +1,16 @@
+#pragma once
+#include <utils/jobs.h>
+
+#include <cstddef>
+
+namespace my_structs {
+// Calls fn(i) for every index of [begin, end) on the shared job system (see
+// utils/jobs.h): the range is split in chunks of at least min_chunk indices
+// that the idle workers steal, and the calling thread works too. Small ranges
+// are executed on the calling thread. It can be called also inside a job
+// (e.g. by a mesh simplified in a batch), the chunks go on the same workers
+template <typename Fn>
+void ParallelFor(std::size_t begin, std::size_t end, Fn fn, std::size_t min_chunk = 1024) {
+  JobSystem::Shared().ParallelFor(begin, end, fn, min_chunk);
+}
+}  // namespace my_structs
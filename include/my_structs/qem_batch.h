@@ -0,0 +1,200 @@
+#pragma once
+#include <my_structs/parallel.h>
+#include <my_structs/simd.h>
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <vector>
+
+namespace my_structs {
+// Costs of many edges evaluated together: the quadrics (Q1 + Q2, only the 10
+// distinct coefficients) and the endpoints are stored in separate arrays, so
+// the three candidate positions of BasicQEM_Edge (the endpoints and the
+// midpoint) are tested on 8 edges at a time with AVX2 or 4 with SSE/NEON.
+// The arithmetic follows the same order of BasicQEM_Edge, so the results
+// are the same of the edges evaluated one by one. The double quadrics are
+// evaluated with the scalar code
+template <typename Scalar>
+class BasicQEM_Batch {
+ public:
+  typedef glm::mat<4, 4, Scalar> Quadric;
+  void Clear() {
+    for (auto& array : q) array.clear();
+    for (auto& array : p1) array.clear();
+    for (auto& array : p2) array.clear();
+    count = 0;
+  }
+  // adds the edge from start to end with Q = Q1 + Q2, returns its position
+  std::size_t Add(const Quadric& Q, glm::vec3 start, glm::vec3 end) {
+    q[0].push_back(Q[0][0]);
+    q[1].push_back(Q[0][1]);
+    q[2].push_back(Q[0][2]);
+    q[3].push_back(Q[0][3]);
+    q[4].push_back(Q[1][1]);
+    q[5].push_back(Q[1][2]);
+    q[6].push_back(Q[1][3]);
+    q[7].push_back(Q[2][2]);
+    q[8].push_back(Q[2][3]);
+    q[9].push_back(Q[3][3]);
+    for (int k = 0; k < 3; ++k) {
+      p1[k].push_back(start[k]);
+      p2[k].push_back(end[k]);
+    }
+    return count++;
+  }
+  std::size_t Size() const { return count; }
+  // blocks of edges are spread over the threads when the batch is large
+  void Evaluate() {
+    for (auto& array : merge) array.resize(count);
+    error.resize(count);
+    std::size_t blocks = (count + kBlock - 1) / kBlock;
+    ParallelFor(0, blocks, [this](std::size_t block) {
+      std::size_t begin = block * kBlock;
+      EvaluateRange(begin, std::min(count, begin + kBlock));
+    }, 8);
+  }
+  glm::vec3 MergePosition(std::size_t i) const { return glm::vec3(merge[0][i], merge[1][i], merge[2][i]); }
+  Scalar Error(std::size_t i) const { return error[i]; }
+
+ private:
+  enum { kBlock = 1024 };
+  std::vector<Scalar> q[10];
+  std::vector<float> p1[3];
+  std::vector<float> p2[3];
+  std::vector<float> merge[3];
+  std::vector<Scalar> error;
+  std::size_t count{0};
+  void EvaluateRange(std::size_t begin, std::size_t end) { EvaluateScalar(begin, end); }
+  Scalar CalculateQEM(std::size_t i, Scalar x, Scalar y, Scalar z) const {
+    Scalar qem = 0;
+    qem += (1 * q[0][i] * x * x);
+    qem += (2 * q[1][i] * x * y);
+    qem += (2 * q[2][i] * x * z);
+    qem += (2 * q[3][i] * x);
+    qem += (1 * q[4][i] * y * y);
+    qem += (2 * q[5][i] * y * z);
+    qem += (2 * q[6][i] * y);
+    qem += (1 * q[7][i] * z * z);
+    qem += (2 * q[8][i] * z);
+    qem += (1 * q[9][i]);
+    return qem;
+  }
+  void EvaluateScalar(std::size_t begin, std::size_t end) {
+    for (std::size_t i = begin; i < end; ++i) {
+      glm::vec3 a = glm::vec3(p1[0][i], p1[1][i], p1[2][i]);
+      glm::vec3 b = glm::vec3(p2[0][i], p2[1][i], p2[2][i]);
+      glm::vec3 c = (a + b) * 0.5f;
+      Scalar qem1 = CalculateQEM(i, a.x, a.y, a.z);
+      Scalar qem2 = CalculateQEM(i, b.x, b.y, b.z);
+      Scalar qem3 = CalculateQEM(i, c.x, c.y, c.z);
+      glm::vec3 position = c;
+      Scalar qem = qem3;
+      if (qem1 < qem2 && qem1 < qem3) {
+        position = a;
+        qem = qem1;
+      } else if (qem2 < qem1 && qem2 < qem3) {
+        position = b;
+        qem = qem2;
+      }
+      merge[0][i] = position.x;
+      merge[1][i] = position.y;
+      merge[2][i] = position.z;
+      error[i] = qem;
+    }
+  }
+  // 4 edges at a time, the rest with the scalar code
+  void EvaluateFloat4(std::size_t begin, std::size_t end) {
+    std::size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+      Float4 Q[10];
+      for (int k = 0; k < 10; ++k) {
+        Q[k] = Float4::Load(&q[k][i]);
+      }
+      Vec3x4 a(Float4::Load(&p1[0][i]), Float4::Load(&p1[1][i]), Float4::Load(&p1[2][i]));
+      Vec3x4 b(Float4::Load(&p2[0][i]), Float4::Load(&p2[1][i]), Float4::Load(&p2[2][i]));
+      Vec3x4 c = (a + b) * Float4(0.5f);
+      Float4 qem1 = CalculateQEM4(Q, a);
+      Float4 qem2 = CalculateQEM4(Q, b);
+      Float4 qem3 = CalculateQEM4(Q, c);
+      Float4 take1 = (qem1 < qem2) & (qem1 < qem3);
+      Float4 take2 = (qem2 < qem1) & (qem2 < qem3);
+      Select(take1, a.x, Select(take2, b.x, c.x)).Store(&merge[0][i]);
+      Select(take1, a.y, Select(take2, b.y, c.y)).Store(&merge[1][i]);
+      Select(take1, a.z, Select(take2, b.z, c.z)).Store(&merge[2][i]);
+      Select(take1, qem1, Select(take2, qem2, qem3)).Store(&error[i]);
+    }
+    EvaluateScalar(i, end);
+  }
+  static Float4 CalculateQEM4(const Float4* Q, const Vec3x4& v) {
+    Float4 two = Float4(2.0f);
+    Float4 qem = Q[0] * v.x * v.x;
+    qem = qem + two * Q[1] * v.x * v.y;
+    qem = qem + two * Q[2] * v.x * v.z;
+    qem = qem + two * Q[3] * v.x;
+    qem = qem + Q[4] * v.y * v.y;
+    qem = qem + two * Q[5] * v.y * v.z;
+    qem = qem + two * Q[6] * v.y;
+    qem = qem + Q[7] * v.z * v.z;
+    qem = qem + two * Q[8] * v.z;
+    qem = qem + Q[9];
+    return qem;
+  }
+#if defined(MY_STRUCTS_SIMD_AVX2)
+  // 8 edges at a time, the rest with the SSE code
+  MY_STRUCTS_TARGET_AVX2 void EvaluateAVX2(std::size_t begin, std::size_t end) {
+    std::size_t i = begin;
+    __m256 half = _mm256_set1_ps(0.5f);
+    for (; i + 8 <= end; i += 8) {
+      __m256 Q[10];
+      for (int k = 0; k < 10; ++k) {
+        Q[k] = _mm256_loadu_ps(&q[k][i]);
+      }
+      __m256 a[3], b[3], c[3];
+      for (int k = 0; k < 3; ++k) {
+        a[k] = _mm256_loadu_ps(&p1[k][i]);
+        b[k] = _mm256_loadu_ps(&p2[k][i]);
+        c[k] = _mm256_mul_ps(_mm256_add_ps(a[k], b[k]), half);
+      }
+      __m256 qem1 = CalculateQEM8(Q, a);
+      __m256 qem2 = CalculateQEM8(Q, b);
+      __m256 qem3 = CalculateQEM8(Q, c);
+      __m256 take1 = _mm256_and_ps(_mm256_cmp_ps(qem1, qem2, _CMP_LT_OQ), _mm256_cmp_ps(qem1, qem3, _CMP_LT_OQ));
+      __m256 take2 = _mm256_and_ps(_mm256_cmp_ps(qem2, qem1, _CMP_LT_OQ), _mm256_cmp_ps(qem2, qem3, _CMP_LT_OQ));
+      for (int k = 0; k < 3; ++k) {
+        _mm256_storeu_ps(&merge[k][i], _mm256_blendv_ps(_mm256_blendv_ps(c[k], b[k], take2), a[k], take1));
+      }
+      _mm256_storeu_ps(&error[i], _mm256_blendv_ps(_mm256_blendv_ps(qem3, qem2, take2), qem1, take1));
+    }
+    EvaluateFloat4(i, end);
+  }
+  MY_STRUCTS_TARGET_AVX2 static __m256 CalculateQEM8(const __m256* Q, const __m256* v) {
+    __m256 two = _mm256_set1_ps(2.0f);
+    __m256 x = v[0], y = v[1], z = v[2];
+    __m256 qem = _mm256_mul_ps(_mm256_mul_ps(Q[0], x), x);
+    qem = _mm256_add_ps(qem, _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(two, Q[1]), x), y));
+    qem = _mm256_add_ps(qem, _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(two, Q[2]), x), z));
+    qem = _mm256_add_ps(qem, _mm256_mul_ps(_mm256_mul_ps(two, Q[3]), x));
+    qem = _mm256_add_ps(qem, _mm256_mul_ps(_mm256_mul_ps(Q[4], y), y));
+    qem = _mm256_add_ps(qem, _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(two, Q[5]), y), z));
+    qem = _mm256_add_ps(qem, _mm256_mul_ps(_mm256_mul_ps(two, Q[6]), y));
+    qem = _mm256_add_ps(qem, _mm256_mul_ps(_mm256_mul_ps(Q[7], z), z));
+    qem = _mm256_add_ps(qem, _mm256_mul_ps(_mm256_mul_ps(two, Q[8]), z));
+    qem = _mm256_add_ps(qem, Q[9]);
+    return qem;
+  }
+#endif
+};
+
+// the float quadrics use the widest kernel supported by the CPU
+template <>
+inline void BasicQEM_Batch<float>::EvaluateRange(std::size_t begin, std::size_t end) {
+#if defined(MY_STRUCTS_SIMD_AVX2)
+  if (CpuHasAVX2()) {
+    EvaluateAVX2(begin, end);
+    return;
+  }
+#endif
+  EvaluateFloat4(begin, end);
+}
+typedef BasicQEM_Batch<float> QEM_Batch;
+}  // namespace my_structs
@@ -1,37 +1,66 @@
 #pragma once
 #include <my_structs/halfedgedata.h>
 
+#include <cstdint>
+
 namespace my_structs {
-class QEM_Edge {
+// Scalar is the type used for the quadrics and the error (float, or double
+// for meshes with very large coordinates, see BasicMeshSimplification_QEM)
+template <typename Scalar>
+class BasicQEM_Edge {
  public:
+  typedef glm::mat<4, 4, Scalar> Quadric;
   HalfEdge* edge;
   glm::vec3 mergePosition;
-  float qem;
-  QEM_Edge(HalfEdge* edge, glm::mat4 Q1, glm::mat4 Q2) {
+  Scalar qem;
+  // position in a BucketEdgeQueue (see edge_queue.h), -1 if not queued
+  int queue_bucket{-1};
+  std::size_t queue_position{0};
+  // unique number given when the edge is created (see Comparator)
+  std::uint32_t order{0};
+  // waiting to be re-costed after a collapse
+  bool dirty{false};
+  // virtual pair (two close vertices without an edge between them): edge
+  // points to the first vertex and virtual_edge to the second one
+  HalfEdge* virtual_edge{nullptr};
+  // the vertex at the other end of edge (or of the virtual pair)
+  HalfEdgeVertex* FirstVertex() const {
+    return virtual_edge != nullptr ? virtual_edge->v : edge->next_edge->next_edge->v;
+  }
+  BasicQEM_Edge(HalfEdge* edge, const Quadric& Q1, const Quadric& Q2) {
     UpdateEdge(edge, Q1, Q2);
   }
-  void UpdateEdge(HalfEdge* edge, glm::mat4 Q1, glm::mat4 Q2) {
+  void UpdateEdge(HalfEdge* edge, const Quadric& Q1, const Quadric& Q2) {
     this->edge = edge;
     CalculateMergePosition(edge, Q1, Q2);
   }
+  // the cost is given later with SetMergePosition (see BasicQEM_Batch)
+  explicit BasicQEM_Edge(HalfEdge* edge) : edge(edge), mergePosition(0.0f), qem(0) {}
+  void SetMergePosition(glm::vec3 position, Scalar error) {
+    mergePosition = position;
+    qem = error;
+  }
   struct Comparator {
-        bool operator()(const QEM_Edge* q1, const QEM_Edge* q2) const {
-            // Sort in ascending order based on the error value
+        bool operator()(const BasicQEM_Edge* q1, const BasicQEM_Edge* q2) const {
+            // Sort in ascending order based on the error value, the ties are
+            // broken by the order of creation (not by the addresses), so the
+            // same mesh is always simplified in the same way
             if(q1->qem == q2->qem) {
-              return q1 < q2;
+              return q1->order < q2->order;
             }
             return q1->qem < q2->qem;
         }
     };
  private:
-  void CalculateMergePosition(HalfEdge* edge, glm::mat4 Q1, glm::mat4 Q2) {
+  void CalculateMergePosition(HalfEdge* edge, const Quadric& Q1, const Quadric& Q2) {
     glm::vec3 p1 = edge->next_edge->next_edge->v->position;
     glm::vec3 p2 = edge->v->position;
     glm::vec3 p3 = (p1 + p2) * 0.5f;
 
-    float qem1 = CalculateQEM(p1, Q1, Q2);
-    float qem2 = CalculateQEM(p2, Q1, Q2);
-    float qem3 = CalculateQEM(p3, Q1, Q2);
+    Quadric Q = Q1 + Q2;
+    Scalar qem1 = CalculateQEM(p1, Q);
+    Scalar qem2 = CalculateQEM(p2, Q);
+    Scalar qem3 = CalculateQEM(p3, Q);
     if (qem1 < qem2 && qem1 < qem3) {
       mergePosition = p1;
       qem = qem1;
@@ -43,30 +72,29 @@ class QEM_Edge {
       qem = qem3;
     }
   }
-  float CalculateQEM(glm::vec3 v, glm::mat4 Q1, glm::mat4 Q2) {
-    glm::mat4 Q = Q1 + Q2;
-
-    float x = v.x;
-    float y = v.y;
-    float z = v.z;
+  Scalar CalculateQEM(glm::vec3 v, const Quadric& Q) {
+    Scalar x = v.x;
+    Scalar y = v.y;
+    Scalar z = v.z;
 
     // v^T * Q * v
     // Verify that this is true (was found at bottom in research paper)
-    float qemCalculations = 0.0f;
-    qemCalculations += (1.0f * Q[0][0] * x * x);
-    qemCalculations += (2.0f * Q[0][1] * x * y);
-    qemCalculations += (2.0f * Q[0][2] * x * z);
-    qemCalculations += (2.0f * Q[0][3] * x);
-    qemCalculations += (1.0f * Q[1][1] * y * y);
-    qemCalculations += (2.0f * Q[1][2] * y * z);
-    qemCalculations += (2.0f * Q[1][3] * y);
-    qemCalculations += (1.0f * Q[2][2] * z * z);
-    qemCalculations += (2.0f * Q[2][3] * z);
-    qemCalculations += (1.0f * Q[3][3]);
+    Scalar qemCalculations = 0;
+    qemCalculations += (1 * Q[0][0] * x * x);
+    qemCalculations += (2 * Q[0][1] * x * y);
+    qemCalculations += (2 * Q[0][2] * x * z);
+    qemCalculations += (2 * Q[0][3] * x);
+    qemCalculations += (1 * Q[1][1] * y * y);
+    qemCalculations += (2 * Q[1][2] * y * z);
+    qemCalculations += (2 * Q[1][3] * y);
+    qemCalculations += (1 * Q[2][2] * z * z);
+    qemCalculations += (2 * Q[2][3] * z);
+    qemCalculations += (1 * Q[3][3]);
 
-    float qem = qemCalculations;
+    Scalar qem = qemCalculations;
 
     return qem;
   }
 };
+typedef BasicQEM_Edge<float> QEM_Edge;
 }  // namespace my_structs
\ No newline at end of file
@@ -0,0 +1,149 @@
+#pragma once
+#include <my_structs/halfedgedata.h>
+#include <my_structs/flat_hash_map.h>
+#include <my_structs/snapshot.h>
+#include <my_structs/content_hash.h>
+
+#include <glm/glm.hpp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace my_structs {
+// Hash of what the simplification depends on: the faces in their order, with
+// the positions and the ids of the corners and the pairing of the edges
+inline std::uint64_t HashMeshContent(const HalfEdgeMesh& mesh) {
+  ContentHash hash;
+  hash.Add(static_cast<std::uint64_t>(mesh.faces.size()));
+  for (auto f : mesh.faces) {
+    for (auto e : f->Edges()) {
+      hash.Add(e->v->position);
+      hash.Add(e->v->id);
+      std::uint8_t paired = e->opposite_edge != nullptr ? 1 : 0;
+      hash.Add(paired);
+    }
+  }
+  return hash.Value();
+}
+// The same, with also the quadric of every corner: the collapses depend on
+// the quadrics too, and two histories can reach the same mesh with different
+// quadrics
+template <typename Quadric>
+std::uint64_t HashMeshContent(const HalfEdgeMesh& mesh, const FlatHashMap<glm::vec3, Quadric>& quadrics) {
+  ContentHash hash;
+  hash.Add(HashMeshContent(mesh));
+  for (auto f : mesh.faces) {
+    for (auto e : f->Edges()) {
+      auto it = quadrics.find(e->v->position);
+      std::uint8_t found = it != quadrics.end() ? 1 : 0;
+      hash.Add(found);
+      if (found) {
+        hash.Add(it->second);
+      }
+    }
+  }
+  return hash.Value();
+}
+
+// the results of an older version of the simplification are not used
+enum { kSimplificationCacheVersion = 2 };
+
+// what identifies a simplification result
+struct SimplificationKey {
+  std::uint64_t content{0};
+  // name of the engine and of its settings (e.g. "qem")
+  std::string engine;
+  // edges to collapse (or faces to reach, depending on the engine)
+  std::int64_t target{0};
+  float max_error{0.0f};
+  std::uint64_t Hash() const {
+    ContentHash hash;
+    hash.Add(static_cast<std::uint32_t>(kSimplificationCacheVersion));
+    hash.Add(content);
+    hash.Add(engine);
+    hash.Add(target);
+    hash.Add(max_error);
+    return hash.Value();
+  }
+};
+
+// On-disk cache of the simplified meshes: every result is a snapshot (see
+// snapshot.h) of the simplified half-edge mesh with its quadrics, so a hit
+// gives back also the state to continue the simplification. The files are
+// named prefix.<key>.hem, a result is first written in a temporary file and
+// then renamed, so a broken write is never read.
+// The stored result must depend only on the key: the caller simplifies from
+// a simplifier built again from the mesh and the quadrics, as after a hit.
+// The cache keeps at most max_entries results, the file prefix.cache lists
+// them from the least recently used, the oldest ones are removed
+class SimplificationCache {
+ public:
+  // e.g. the path of the model, the results are saved next to it
+  explicit SimplificationCache(const std::string& prefix, std::size_t max_entries = 16)
+      : prefix(prefix), max_entries(max_entries) {}
+  std::string EntryPath(const SimplificationKey& key) const {
+    return EntryPath(EntryName(key));
+  }
+  // true if the result was found: mesh and quadrics are replaced with it
+  template <typename Quadric>
+  bool Load(const SimplificationKey& key, HalfEdgeMesh& mesh, FlatHashMap<glm::vec3, Quadric>& quadrics) const {
+    if (!LoadSnapshot(EntryPath(key), mesh, quadrics)) return false;
+    Touch(EntryName(key));
+    return true;
+  }
+  template <typename Quadric>
+  bool Store(const SimplificationKey& key, const HalfEdgeMesh& mesh, const FlatHashMap<glm::vec3, Quadric>* quadrics) const {
+    std::string path = EntryPath(key);
+    std::string temporary = path + ".tmp";
+    if (!SaveSnapshot(temporary, mesh, quadrics)) {
+      std::remove(temporary.c_str());
+      return false;
+    }
+    // rename doesn't replace an existing file on Windows
+    std::remove(path.c_str());
+    if (std::rename(temporary.c_str(), path.c_str()) != 0) return false;
+    Touch(EntryName(key));
+    return true;
+  }
+
+ private:
+  std::string prefix;
+  std::size_t max_entries;
+  static std::string EntryName(const SimplificationKey& key) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key.Hash()));
+    return name;
+  }
+  std::string EntryPath(const std::string& name) const { return prefix + "." + name + ".hem"; }
+  // moves name at the end of the list and removes the oldest entries
+  void Touch(const std::string& name) const {
+    std::string index_path = prefix + ".cache";
+    std::vector<std::string> names;
+    {
+      std::ifstream in(index_path);
+      std::string line;
+      while (std::getline(in, line)) {
+        if (line.size() == 16 && line != name) names.push_back(line);
+      }
+    }
+    names.push_back(name);
+    std::size_t evicted = names.size() > max_entries ? names.size() - max_entries : 0;
+    for (std::size_t i = 0; i < evicted; ++i) {
+      std::remove(EntryPath(names[i]).c_str());
+    }
+    names.erase(names.begin(), names.begin() + evicted);
+    std::string temporary = index_path + ".tmp";
+    {
+      std::ofstream out(temporary, std::ios::trunc);
+      for (auto& entry : names) {
+        out << entry << "\n";
+      }
+    }
+    std::remove(index_path.c_str());
+    std::rename(temporary.c_str(), index_path.c_str());
+  }
+};
+}  // namespace my_structs
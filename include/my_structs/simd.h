@@ -0,0 +1,205 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MY_STRUCTS_SIMD_SSE 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MY_STRUCTS_SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// the AVX2 kernels are compiled next to the SSE ones and chosen at runtime
+// (CpuHasAVX2), the rest of the program doesn't need /arch:AVX2 or -mavx2
+#if defined(MY_STRUCTS_SIMD_SSE) && (defined(_MSC_VER) || defined(__GNUC__) || defined(__clang__))
+#define MY_STRUCTS_SIMD_AVX2 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define MY_STRUCTS_TARGET_AVX2
+#else
+#define MY_STRUCTS_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+namespace my_structs {
+// Four floats processed together: SSE2 on x86, NEON on ARM and a plain array
+// elsewhere. The comparisons return masks (all bits set in the true lanes)
+// that are used with Select and AnyTrue. Min and Max return the second
+// operand when one of the two is NaN, as the SSE instructions do
+struct Float4 {
+#if defined(MY_STRUCTS_SIMD_SSE)
+  __m128 v;
+  Float4() = default;
+  Float4(__m128 v) : v(v) {}
+  explicit Float4(float x) : v(_mm_set1_ps(x)) {}
+  static Float4 Load(const float* p) { return Float4(_mm_loadu_ps(p)); }
+  void Store(float* p) const { _mm_storeu_ps(p, v); }
+#elif defined(MY_STRUCTS_SIMD_NEON)
+  float32x4_t v;
+  Float4() = default;
+  Float4(float32x4_t v) : v(v) {}
+  explicit Float4(float x) : v(vdupq_n_f32(x)) {}
+  static Float4 Load(const float* p) { return Float4(vld1q_f32(p)); }
+  void Store(float* p) const { vst1q_f32(p, v); }
+#else
+  float v[4];
+  Float4() = default;
+  explicit Float4(float x) { v[0] = v[1] = v[2] = v[3] = x; }
+  static Float4 Load(const float* p) {
+    Float4 r;
+    std::memcpy(r.v, p, sizeof(r.v));
+    return r;
+  }
+  void Store(float* p) const { std::memcpy(p, v, sizeof(v)); }
+#endif
+};
+
+#if defined(MY_STRUCTS_SIMD_SSE)
+inline Float4 operator+(Float4 a, Float4 b) { return _mm_add_ps(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b) { return _mm_sub_ps(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b) { return _mm_mul_ps(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b) { return _mm_div_ps(a.v, b.v); }
+inline Float4 Min(Float4 a, Float4 b) { return _mm_min_ps(a.v, b.v); }
+inline Float4 Max(Float4 a, Float4 b) { return _mm_max_ps(a.v, b.v); }
+inline Float4 operator<(Float4 a, Float4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline Float4 operator<=(Float4 a, Float4 b) { return _mm_cmple_ps(a.v, b.v); }
+inline Float4 operator>(Float4 a, Float4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline Float4 operator>=(Float4 a, Float4 b) { return _mm_cmpge_ps(a.v, b.v); }
+inline Float4 operator&(Float4 a, Float4 b) { return _mm_and_ps(a.v, b.v); }
+inline Float4 operator|(Float4 a, Float4 b) { return _mm_or_ps(a.v, b.v); }
+// mask ? a : b
+inline Float4 Select(Float4 mask, Float4 a, Float4 b) {
+  return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+}
+inline int MoveMask(Float4 mask) { return _mm_movemask_ps(mask.v); }
+#elif defined(MY_STRUCTS_SIMD_NEON)
+inline Float4 operator+(Float4 a, Float4 b) { return vaddq_f32(a.v, b.v); }
+inline Float4 operator-(Float4 a, Float4 b) { return vsubq_f32(a.v, b.v); }
+inline Float4 operator*(Float4 a, Float4 b) { return vmulq_f32(a.v, b.v); }
+inline Float4 operator/(Float4 a, Float4 b) {
+  float x[4], y[4];
+  vst1q_f32(x, a.v);
+  vst1q_f32(y, b.v);
+  for (int i = 0; i < 4; ++i) x[i] /= y[i];
+  return vld1q_f32(x);
+}
+inline Float4 operator<(Float4 a, Float4 b) { return vreinterpretq_f32_u32(vcltq_f32(a.v, b.v)); }
+inline Float4 operator<=(Float4 a, Float4 b) { return vreinterpretq_f32_u32(vcleq_f32(a.v, b.v)); }
+inline Float4 operator>(Float4 a, Float4 b) { return vreinterpretq_f32_u32(vcgtq_f32(a.v, b.v)); }
+inline Float4 operator>=(Float4 a, Float4 b) { return vreinterpretq_f32_u32(vcgeq_f32(a.v, b.v)); }
+inline Float4 operator&(Float4 a, Float4 b) {
+  return vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(a.v), vreinterpretq_u32_f32(b.v)));
+}
+inline Float4 operator|(Float4 a, Float4 b) {
+  return vreinterpretq_f32_u32(vorrq_u32(vreinterpretq_u32_f32(a.v), vreinterpretq_u32_f32(b.v)));
+}
+inline Float4 Select(Float4 mask, Float4 a, Float4 b) { return vbslq_f32(vreinterpretq_u32_f32(mask.v), a.v, b.v); }
+// a < b ? a : b keeps the SSE behaviour with NaN
+inline Float4 Min(Float4 a, Float4 b) { return Select(a < b, a, b); }
+inline Float4 Max(Float4 a, Float4 b) { return Select(a > b, a, b); }
+inline int MoveMask(Float4 mask) {
+  std::uint32_t m[4];
+  vst1q_u32(m, vreinterpretq_u32_f32(mask.v));
+  return int(m[0] >> 31) | int(m[1] >> 31) << 1 | int(m[2] >> 31) << 2 | int(m[3] >> 31) << 3;
+}
+#else
+namespace simd_detail {
+inline float MaskBits(bool value) {
+  std::uint32_t bits = value ? 0xFFFFFFFFu : 0u;
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+inline std::uint32_t Bits(float value) {
+  std::uint32_t bits;
+  std::memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+inline float FromBits(std::uint32_t bits) {
+  float f;
+  std::memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+}  // namespace simd_detail
+#define MY_STRUCTS_FLOAT4_OP(name, expression)       \
+  inline Float4 name(Float4 a, Float4 b) {           \
+    Float4 r;                                        \
+    for (int i = 0; i < 4; ++i) {                    \
+      float x = a.v[i];                              \
+      float y = b.v[i];                              \
+      r.v[i] = expression;                           \
+    }                                                \
+    return r;                                        \
+  }
+MY_STRUCTS_FLOAT4_OP(operator+, x + y)
+MY_STRUCTS_FLOAT4_OP(operator-, x - y)
+MY_STRUCTS_FLOAT4_OP(operator*, x * y)
+MY_STRUCTS_FLOAT4_OP(operator/, x / y)
+MY_STRUCTS_FLOAT4_OP(Min, x < y ? x : y)
+MY_STRUCTS_FLOAT4_OP(Max, x > y ? x : y)
+MY_STRUCTS_FLOAT4_OP(operator<, simd_detail::MaskBits(x < y))
+MY_STRUCTS_FLOAT4_OP(operator<=, simd_detail::MaskBits(x <= y))
+MY_STRUCTS_FLOAT4_OP(operator>, simd_detail::MaskBits(x > y))
+MY_STRUCTS_FLOAT4_OP(operator>=, simd_detail::MaskBits(x >= y))
+MY_STRUCTS_FLOAT4_OP(operator&, simd_detail::FromBits(simd_detail::Bits(x) & simd_detail::Bits(y)))
+MY_STRUCTS_FLOAT4_OP(operator|, simd_detail::FromBits(simd_detail::Bits(x) | simd_detail::Bits(y)))
+#undef MY_STRUCTS_FLOAT4_OP
+inline Float4 Select(Float4 mask, Float4 a, Float4 b) {
+  Float4 r;
+  for (int i = 0; i < 4; ++i) {
+    r.v[i] = (simd_detail::Bits(mask.v[i]) >> 31) ? a.v[i] : b.v[i];
+  }
+  return r;
+}
+inline int MoveMask(Float4 mask) {
+  int bits = 0;
+  for (int i = 0; i < 4; ++i) {
+    bits |= int(simd_detail::Bits(mask.v[i]) >> 31) << i;
+  }
+  return bits;
+}
+#endif
+
+inline bool AnyTrue(Float4 mask) { return MoveMask(mask) != 0; }
+
+// true if the CPU and the OS support AVX2, checked only once
+inline bool CpuHasAVX2() {
+#if defined(MY_STRUCTS_SIMD_AVX2) && defined(_MSC_VER) && !defined(__clang__)
+  static const bool supported = []() {
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] < 7) return false;
+    __cpuid(info, 1);
+    // the OS must save the AVX registers (OSXSAVE and XCR0)
+    if ((info[2] & (1 << 27)) == 0 || (_xgetbv(0) & 6) != 6) return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+  }();
+  return supported;
+#elif defined(MY_STRUCTS_SIMD_AVX2)
+  static const bool supported = __builtin_cpu_supports("avx2") != 0;
+  return supported;
+#else
+  return false;
+#endif
+}
+
+// three Float4 used as four 3D vectors (one for every lane)
+struct Vec3x4 {
+  Float4 x, y, z;
+  Vec3x4() = default;
+  Vec3x4(Float4 x, Float4 y, Float4 z) : x(x), y(y), z(z) {}
+  // the same vector in all the lanes
+  explicit Vec3x4(const float* p) : x(p[0]), y(p[1]), z(p[2]) {}
+};
+inline Vec3x4 operator+(const Vec3x4& a, const Vec3x4& b) { return Vec3x4(a.x + b.x, a.y + b.y, a.z + b.z); }
+inline Vec3x4 operator-(const Vec3x4& a, const Vec3x4& b) { return Vec3x4(a.x - b.x, a.y - b.y, a.z - b.z); }
+inline Vec3x4 operator*(const Vec3x4& a, Float4 s) { return Vec3x4(a.x * s, a.y * s, a.z * s); }
+inline Float4 Dot(const Vec3x4& a, const Vec3x4& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+inline Vec3x4 Cross(const Vec3x4& a, const Vec3x4& b) {
+  return Vec3x4(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+}  // namespace my_structs
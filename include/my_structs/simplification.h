@@ -1,55 +1,216 @@
 #pragma once
 #include <my_structs/halfedgedata.h>
 #include <my_structs/qem_edge.h>
-#include <unordered_map>
+#include <my_structs/qem_batch.h>
+#include <my_structs/flat_hash_map.h>
+#include <my_structs/edge_queue.h>
+#include <algorithm>
+#include <cstdint>
 #include <iostream>
-#include <set>
+#include <vector>
 namespace my_structs { 
-class MeshSimplification_QEM {
+// Scalar is the type of the quadrics: float is enough for the usual models,
+// double (MeshSimplification_QEM_Double) keeps the precision of the sums
+// of the quadrics when the coordinates are very large.
+// Queue decides the order of the collapses: ExactEdgeQueue always takes the
+// smallest error, BucketEdgeQueue (MeshSimplification_QEM_Bucketed) takes an
+// edge with about the smallest error in O(1), good enough for the far LODs
+template <typename Scalar, typename Queue = ExactEdgeQueue<BasicQEM_Edge<Scalar>>>
+class BasicMeshSimplification_QEM {
   public:
+    typedef BasicQEM_Edge<Scalar> QEM_Edge;
+    typedef typename QEM_Edge::Quadric Quadric;
     HalfEdgeMesh& mesh_data;
-    std::unordered_map<glm::vec3, glm::mat4, Vec3Hash> q_matrices = std::unordered_map<glm::vec3, glm::mat4, Vec3Hash>();
+    FlatHashMap<glm::vec3, Quadric> q_matrices = FlatHashMap<glm::vec3, Quadric>();
     //std::vector<QEM_Edge*> qem_edges = std::vector<QEM_Edge*>();
-    std::set<QEM_Edge*,QEM_Edge::Comparator> qem_edges = std::set<QEM_Edge*,QEM_Edge::Comparator>();
+    Queue qem_edges = Queue();
     //MinHeap min_heap_QEM = MinHeap();
-    std::unordered_map<HalfEdge*, QEM_Edge*> edge_QEM_lookup = std::unordered_map<HalfEdge*, QEM_Edge*>();
+    FlatHashMap<HalfEdge*, QEM_Edge*> edge_QEM_lookup = FlatHashMap<HalfEdge*, QEM_Edge*>();
     std::pair<glm::vec3, glm::vec3> next_edge_to_collapse = std::make_pair(glm::vec3(0.0f), glm::vec3(0.0f));
     //QEM_Edge* smalles_error_edge;
-    QEM_Edge* smallest_error_edge;
-    MeshSimplification_QEM(HalfEdgeMesh& mesh_data) : mesh_data(mesh_data){
+    // next edge to collapse, nullptr when the queue is exhausted
+    QEM_Edge* smallest_error_edge{nullptr};
+    // QEM edges to re-cost after a collapse
+    std::vector<QEM_Edge*> dirty_edges;
+    // the costs of the new and of the dirty edges are evaluated together
+    BasicQEM_Batch<Scalar> cost_batch;
+    // every virtual pair created by AddVirtualPairs (the discarded ones have
+    // edge == nullptr and are freed by ReorderMesh)
+    std::vector<QEM_Edge*> virtual_pairs;
+    // the positions where a virtual pair left more than one fan, with an
+    // edge pointing to the vertex of every fan
+    FlatHashMap<glm::vec3, std::vector<HalfEdge*>> virtual_fans;
+    // positions of the vertices that must not move (e.g. the seams between
+    // the chunks of a streamed mesh), see LockVertex
+    FlatHashMap<glm::vec3, bool> locked_positions;
+    BasicMeshSimplification_QEM(HalfEdgeMesh& mesh_data) : mesh_data(mesh_data){
+      q_matrices.reserve(mesh_data.vertex_count);
+      edge_QEM_lookup.reserve(mesh_data.edges.size());
       for(auto v : mesh_data.vertices) {
         if(q_matrices.find(v->position) != q_matrices.end()) {
           continue;
         }
-        std::vector<HalfEdge*> edges_to_vertex = v->GetEdgesPointingToVertex(&mesh_data);
-        glm::mat4 Q = CalculateQMatrix(edges_to_vertex);
+        Quadric Q = Quadric(0);
+        for(auto e : v->IncomingEdges()) {
+          Q += CalculateFaceQuadric(e);
+        }
         q_matrices[v->position] = Q;
       }
+      BuildQueue();
+    };
+    // the quadrics of the vertices are already known (e.g. from a snapshot)
+    BasicMeshSimplification_QEM(HalfEdgeMesh& mesh_data, FlatHashMap<glm::vec3, Quadric> quadrics) : mesh_data(mesh_data){
+      q_matrices.swap(quadrics);
+      edge_QEM_lookup.reserve(mesh_data.edges.size());
+      BuildQueue();
+    };
+    BasicMeshSimplification_QEM(const BasicMeshSimplification_QEM&) = delete;
+    BasicMeshSimplification_QEM& operator=(const BasicMeshSimplification_QEM&) = delete;
+    // the QEM edges are shared by the two half-edges of an edge, every one
+    // is freed once (the virtual pairs are only in virtual_pairs). The
+    // lookup has only the live half-edges (see ForgetRemovedEdges)
+    ~BasicMeshSimplification_QEM() {
+      std::vector<QEM_Edge*> owned;
+      owned.reserve(edge_QEM_lookup.size() / 2 + virtual_pairs.size() + 1);
+      for(auto& item : edge_QEM_lookup) {
+        owned.push_back(item.second);
+      }
+      owned.insert(owned.end(), virtual_pairs.begin(), virtual_pairs.end());
+      if(smallest_error_edge != nullptr) {
+        owned.push_back(smallest_error_edge);
+      }
+      std::sort(owned.begin(), owned.end());
+      owned.erase(std::unique(owned.begin(), owned.end()), owned.end());
+      for(auto qem_edge : owned) {
+        delete qem_edge;
+      }
+    }
+    // true when no edge is left in the queue, the mesh can't be simplified more
+    bool Exhausted() const { return smallest_error_edge == nullptr; }
+    // the vertices at position are never moved: the edges and the virtual
+    // pairs that touch them are not collapsed
+    void LockVertex(glm::vec3 position) {
+      locked_positions[position] = true;
+    }
+    // Reorders the mesh along the Morton curve (see HalfEdgeMesh) and moves
+    // the QEM edges on the reallocated half-edges, the queue is not changed
+    void ReorderMesh() {
+      std::vector<std::pair<HalfEdge*, HalfEdge*>> edge_remap;
+      RepairVirtualPairs();
+      mesh_data.ReorderByMortonCurve(&edge_remap);
+      FlatHashMap<HalfEdge*, QEM_Edge*> new_lookup;
+      new_lookup.reserve(edge_remap.size());
+      for(auto& item : edge_remap) {
+        auto it = edge_QEM_lookup.find(item.first);
+        if(it != edge_QEM_lookup.end()) {
+          it->second->edge = item.second;
+          new_lookup[item.second] = it->second;
+        }
+      }
+      edge_QEM_lookup.swap(new_lookup);
+      if(virtual_pairs.empty()) return;
+      FlatHashMap<HalfEdge*, HalfEdge*> remap;
+      remap.reserve(edge_remap.size());
+      for(auto& item : edge_remap) {
+        remap[item.first] = item.second;
+      }
+      for(auto pair : virtual_pairs) {
+        pair->edge = remap[pair->edge];
+        pair->virtual_edge = remap[pair->virtual_edge];
+      }
+      for(auto& item : virtual_fans) {
+        for(auto& fan : item.second) {
+          fan = remap[fan];
+        }
+      }
+    }
+    // Adds to the queue the pairs of vertices closer than max_distance that
+    // don't share an edge (e.g. two parts of the model that touch), so that
+    // they can be joined like the edges and the parts can merge in the far
+    // LODs. The pairs are found with a uniform grid of cells as large as
+    // max_distance, returns the number of pairs
+    std::size_t AddVirtualPairs(float max_distance) {
+      if(!(max_distance > 0.0f) || mesh_data.edges.empty()) return 0;
+      // one edge pointing to every vertex id
+      std::vector<HalfEdge*> by_id(mesh_data.vertex_count, nullptr);
+      glm::vec3 min = mesh_data.edges[0]->v->position;
       for(auto e : mesh_data.edges) {
-        glm::vec3 p1 = e->next_edge->next_edge->v->position;
-        glm::vec3 p2 = e->v->position;
-        glm::mat4 Q1 = q_matrices[p1];
-        glm::mat4 Q2 = q_matrices[p2];
-        QEM_Edge* qem_edge = new QEM_Edge(e, Q1, Q2);
-        //qem_edges.push_back(qem_edge);
-        //min_heap_QEM.insert(qem_edge);
-        edge_QEM_lookup[e] = qem_edge;
-        qem_edges.insert(qem_edge);
+        if(by_id[e->v->id] == nullptr) {
+          by_id[e->v->id] = e;
+          min = glm::min(min, e->v->position);
+        }
       }
-      //smalles_error_edge = *std::min_element(qem_edges.begin(), qem_edges.end(), [](QEM_Edge* a, QEM_Edge* b) {
-      //    return a->qem < b->qem;
-      //  });
-      //smalles_error_edge = min_heap_QEM.extractMin();
-      smallest_error_edge = *qem_edges.begin();
-      qem_edges.erase(qem_edges.begin());
-    };
-    ~MeshSimplification_QEM() = default;
+      auto cell_of = [&](glm::vec3 p) {
+        glm::vec3 cell = glm::floor((p - min) / max_distance);
+        return glm::clamp(glm::ivec3(cell), glm::ivec3(0), glm::ivec3((1 << 21) - 2));
+      };
+      auto code_of = [](glm::ivec3 cell) {
+        return (std::uint64_t(cell.x) << 42) | (std::uint64_t(cell.y) << 21) | std::uint64_t(cell.z);
+      };
+      std::vector<std::pair<std::uint64_t, int>> cells;
+      for(std::size_t id = 0; id < by_id.size(); ++id) {
+        if(by_id[id] != nullptr) {
+          cells.push_back(std::make_pair(code_of(cell_of(by_id[id]->v->position)), static_cast<int>(id)));
+        }
+      }
+      std::sort(cells.begin(), cells.end());
+      std::vector<int> neighbours;
+      std::vector<QEM_Edge*> new_pairs;
+      for(auto& item : cells) {
+        HalfEdge* a = by_id[item.second];
+        glm::vec3 pa = a->v->position;
+        neighbours.clear();
+        for(auto edge : a->v->IncomingEdges()) {
+          neighbours.push_back(edge->next_edge->v->id);
+          neighbours.push_back(edge->next_edge->next_edge->v->id);
+        }
+        glm::ivec3 cell = cell_of(pa);
+        for(int dz = -1; dz <= 1; ++dz) {
+          for(int dy = -1; dy <= 1; ++dy) {
+            for(int dx = -1; dx <= 1; ++dx) {
+              glm::ivec3 other = cell + glm::ivec3(dx, dy, dz);
+              if(other.x < 0 || other.y < 0 || other.z < 0) continue;
+              auto range = std::equal_range(cells.begin(), cells.end(), std::make_pair(code_of(other), 0),
+                  [](const std::pair<std::uint64_t, int>& l, const std::pair<std::uint64_t, int>& r) { return l.first < r.first; });
+              for(auto it = range.first; it != range.second; ++it) {
+                // every pair once, the vertices at the same position are kept apart
+                if(it->second <= item.second) continue;
+                HalfEdge* b = by_id[it->second];
+                glm::vec3 pb = b->v->position;
+                if(pa == pb || glm::distance(pa, pb) > max_distance) continue;
+                if(std::find(neighbours.begin(), neighbours.end(), it->second) != neighbours.end()) continue;
+                QEM_Edge* pair = new QEM_Edge(a);
+                pair->virtual_edge = b;
+                pair->order = next_order++;
+                new_pairs.push_back(pair);
+              }
+            }
+          }
+        }
+      }
+      if(new_pairs.empty()) return 0;
+      EvaluateCosts(new_pairs.data(), new_pairs.size());
+      for(auto pair : new_pairs) {
+        qem_edges.Push(pair);
+        virtual_pairs.push_back(pair);
+      }
+      // a new pair can be cheaper than the next edge
+      if(smallest_error_edge != nullptr) {
+        qem_edges.Push(smallest_error_edge);
+      }
+      PopNextEdge();
+      return new_pairs.size();
+    }
     bool SimplifyMesh(int max_edges, float max_error) {
       for(int i = 0; i < max_edges; ++i) {
         if(mesh_data.faces.size() <= 5) {
           std::cout << "MeshSimplification_QEM: Mesh has less than 4 faces" << std::endl;
           return false;
         }
+        if(Exhausted()) {
+          std::cout << "MeshSimplification_QEM: No edge left to collapse" << std::endl;
+          return false;
+        }
         //if(smalles_error_edge->edge->f == nullptr) {
           //std::cout << "MeshSimplification_QEM: Edge has no face" << std::endl;
           //qem_edges.erase(std::remove(qem_edges.begin(), qem_edges.end(), smalles_error_edge), qem_edges.end());
@@ -62,87 +223,365 @@ class MeshSimplification_QEM {
         }
         //HalfEdge* edge_to_contract = smalles_error_edge->edge;
         HalfEdge* edge_to_contract = smallest_error_edge->edge;
-        
-        q_matrices.erase(edge_to_contract->v->position);
-        q_matrices.erase(edge_to_contract->next_edge->next_edge->v->position);
-        std::vector<HalfEdge*> edges_to_new_vertex = mesh_data.ContractHalfEdge(edge_to_contract, smallest_error_edge->mergePosition);
-        glm::mat4 Q_new = CalculateQMatrix(edges_to_new_vertex);
-        q_matrices[smallest_error_edge->mergePosition] = Q_new;
-        for(auto edge_to_v : edges_to_new_vertex) {
-          HalfEdge* edge_from_v = edge_to_v->next_edge;
-          // TO
-          QEM_Edge* qem_edge_to_v = edge_QEM_lookup[edge_to_v];
-          glm::vec3 p1 = edge_to_v->next_edge->next_edge->v->position;
-          glm::vec3 p2 = edge_to_v->v->position;
-          glm::mat4 Q1_edge_to_v = q_matrices[p1];
-          glm::mat4 Q2_edge_to_v = Q_new;
-          //qem_edge_to_v->UpdateEdge(edge_to_v, Q1_edge_to_v, Q2_edge_to_v);
-          //min_heap_QEM.updateError(qem_edge_to_v, qem_edge_to_v->qem);
-          auto it = qem_edges.find(qem_edge_to_v);
-          if(it != qem_edges.end()) {
-            qem_edges.erase(it);
-            delete qem_edge_to_v;
-            QEM_Edge* new_qem_edge_to_v = new QEM_Edge(edge_to_v, Q1_edge_to_v, Q2_edge_to_v);
-            qem_edges.insert(new_qem_edge_to_v);
-            edge_QEM_lookup[edge_to_v] = new_qem_edge_to_v;
+        bool is_virtual = smallest_error_edge->virtual_edge != nullptr;
+        // collapses that move a locked vertex, flip a face or pinch the
+        // surface are skipped, the edge comes back in the queue when one of
+        // its vertices moves
+        if(IsLocked(smallest_error_edge) ||
+           (is_virtual ? !IsVirtualPairValid(smallest_error_edge)
+                       : !mesh_data.IsCollapseValid(edge_to_contract, smallest_error_edge->mergePosition))) {
+          if(!PopNextEdge()) {
+            std::cout << "MeshSimplification_QEM: No valid edge to collapse" << std::endl;
+            return false;
+          }
+          --i;
+          continue;
+        }
+
+        glm::vec3 p1 = smallest_error_edge->FirstVertex()->position;
+        glm::vec3 p2 = edge_to_contract->v->position;
+        glm::vec3 merge_position = smallest_error_edge->mergePosition;
+        int merged_id = edge_to_contract->v->id;
+        q_matrices.erase(p2);
+        q_matrices.erase(p1);
+        dirty_edges.clear();
+        moved_edges.clear();
+        if(is_virtual) {
+          // no face is removed, the fans of the two vertices are moved
+          q_matrices[merge_position] = Quadric(0);
+          virtual_fans[p1].push_back(smallest_error_edge->virtual_edge);
+          virtual_fans[p2].push_back(edge_to_contract);
+          smallest_error_edge->edge = nullptr;
+        } else {
+          CollectRemovedEdges(edge_to_contract);
+          const std::vector<HalfEdge*>& edges_to_new_vertex = mesh_data.ContractHalfEdge(edge_to_contract, merge_position);
+          ForgetRemovedEdges();
+          Quadric Q_new = CalculateQMatrix(edges_to_new_vertex);
+          q_matrices[merge_position] = Q_new;
+          // every edge around the new vertex is re-costed once: the TO edge of a
+          // face is the FROM edge of the next face of the fan
+          for(auto edge_to_v : edges_to_new_vertex) {
+            MarkEdgeDirty(edge_to_v);
+            MarkEdgeDirty(edge_to_v->next_edge);
           }
-          // FROM
-          QEM_Edge* qem_edge_from_v = edge_QEM_lookup[edge_from_v];
-          glm::vec3 p3 = edge_from_v->next_edge->next_edge->v->position;
-          glm::vec3 p4 = edge_from_v->v->position;
-          glm::mat4 Q3_edge_from_v = Q_new;
-          glm::mat4 Q4_edge_from_v = q_matrices[p4];
-          //qem_edge_from_v->UpdateEdge(edge_from_v, Q3_edge_from_v, Q4_edge_from_v);
-          //min_heap_QEM.updateError(qem_edge_from_v, qem_edge_from_v->qem);
-          it = qem_edges.find(qem_edge_from_v);
-          if(it != qem_edges.end()) {
-            qem_edges.erase(it);
-            delete qem_edge_from_v;
-            QEM_Edge* new_qem_edge_from_v = new QEM_Edge(edge_from_v, Q3_edge_from_v, Q4_edge_from_v);
-            qem_edges.insert(new_qem_edge_from_v);
-            edge_QEM_lookup[edge_from_v] = new_qem_edge_from_v;
+          if(!virtual_fans.empty()) {
+            moved_edges = edges_to_new_vertex;
           }
         }
+        if(!virtual_fans.empty()) {
+          MoveFans(p1, p2, merge_position, merged_id);
+        }
+        UpdateDirtyEdges();
         //qem_edges.erase(std::remove(qem_edges.begin(), qem_edges.end(), smalles_error_edge), qem_edges.end());
         //smalles_error_edge = *std::min_element(qem_edges.begin(), qem_edges.end(), [](QEM_Edge* a, QEM_Edge* b) {
         //  return a->qem < b->qem;
         //});
         //smalles_error_edge = min_heap_QEM.extractMin();
-        smallest_error_edge = *qem_edges.begin();
         //while (smalles_error_edge->edge->f == nullptr) {
           //smalles_error_edge = min_heap_QEM.extractMin();
         //}
-        while (smallest_error_edge->edge->f == nullptr) {
-          smallest_error_edge = *qem_edges.begin();
-          qem_edges.erase(qem_edges.begin());
+        if(!PopNextEdge()) {
+          std::cout << "MeshSimplification_QEM: No edge left to collapse" << std::endl;
+          return false;
         }
-        //next_edge_to_collapse = std::make_pair(smalles_error_edge->edge->v->position, smalles_error_edge->edge->next_edge->next_edge->v->position);
-        next_edge_to_collapse = std::make_pair(smallest_error_edge->edge->v->position, smallest_error_edge->edge->next_edge->next_edge->v->position);
       }
       return true;
     }
   private:
-    glm::mat4 CalculateQMatrix(std::vector<HalfEdge*> edges) {
-      glm::mat4 Q = glm::mat4(0.0f);
+    // order of the next QEM edge created, in the order of the edges of the mesh
+    std::uint32_t next_order{0};
+    // scratch buffers of MoveFans
+    std::vector<HalfEdge*> fans;
+    std::vector<HalfEdge*> moved_edges;
+    // the half-edges of the faces removed by a collapse, with their opposite
+    // before the collapse (the removal unlinks the opposites)
+    std::vector<std::pair<HalfEdge*, HalfEdge*>> removed_edges;
+    std::vector<std::pair<QEM_Edge*, HalfEdge*>> removed_qem_edges;
+    void CollectRemovedEdges(HalfEdge* e) {
+      removed_edges.clear();
+      HalfEdgeFace* removed_faces[2] = {e->f, e->opposite_edge != nullptr ? e->opposite_edge->f : nullptr};
+      for(auto f : removed_faces) {
+        if(f == nullptr) continue;
+        for(auto edge : f->Edges()) {
+          removed_edges.push_back(std::make_pair(edge, edge->opposite_edge));
+        }
+      }
+    }
+    // The removed half-edges leave the lookup and the QEM edges that no live
+    // half-edge uses any more (e.g. the one of the collapsed edge) are freed,
+    // so the lookup never points to a QEM edge freed by MarkEdgeDirty
+    void ForgetRemovedEdges() {
+      removed_qem_edges.clear();
+      for(auto& item : removed_edges) {
+        if(item.first->f != nullptr) continue;
+        auto it = edge_QEM_lookup.find(item.first);
+        if(it == edge_QEM_lookup.end()) continue;
+        removed_qem_edges.push_back(std::make_pair(it->second, item.second));
+        edge_QEM_lookup.erase(item.first);
+      }
+      std::sort(removed_qem_edges.begin(), removed_qem_edges.end());
+      for(std::size_t i = 0; i < removed_qem_edges.size(); ++i) {
+        QEM_Edge* qem_edge = removed_qem_edges[i].first;
+        if(i > 0 && removed_qem_edges[i - 1].first == qem_edge) continue;
+        // the QEM edge is kept if the opposite half-edge is alive and uses it
+        HalfEdge* opposite = removed_qem_edges[i].second;
+        if(opposite != nullptr && opposite->f != nullptr) {
+          auto it = edge_QEM_lookup.find(opposite);
+          if(it != edge_QEM_lookup.end() && it->second == qem_edge) continue;
+        }
+        qem_edges.Remove(qem_edge);
+        if(qem_edge == smallest_error_edge) {
+          smallest_error_edge = nullptr;
+        }
+        delete qem_edge;
+      }
+    }
+    // Before a reorder the virtual pairs and fans must point to edges that
+    // are still alive (the removed ones are not moved): the discarded pairs
+    // are freed and the others follow their fans to a live edge
+    void RepairVirtualPairs() {
+      std::size_t kept = 0;
+      for(auto pair : virtual_pairs) {
+        if(pair == smallest_error_edge) {
+          virtual_pairs[kept++] = pair;
+          continue;
+        }
+        if(pair->edge != nullptr) {
+          pair->edge = FindLiveEdge(pair->edge);
+          pair->virtual_edge = FindLiveEdge(pair->virtual_edge);
+          if(pair->edge != nullptr && pair->virtual_edge != nullptr) {
+            virtual_pairs[kept++] = pair;
+            continue;
+          }
+          qem_edges.Remove(pair);
+        }
+        delete pair;
+      }
+      virtual_pairs.resize(kept);
+      for(auto& item : virtual_fans) {
+        std::vector<HalfEdge*>& item_fans = item.second;
+        for(auto& fan : item_fans) {
+          fan = FindLiveEdge(fan);
+        }
+        item_fans.erase(std::remove(item_fans.begin(), item_fans.end(), nullptr), item_fans.end());
+      }
+    }
+    // takes the smallest QEM edge that still has a face out of the queue,
+    // false (and smallest_error_edge is nullptr) if the queue is empty
+    bool PopNextEdge() {
+      while(!qem_edges.Empty()) {
+        smallest_error_edge = qem_edges.PopMin();
+        if(smallest_error_edge->virtual_edge != nullptr) {
+          // the virtual pairs are not updated by the collapses, they are
+          // checked and re-costed only when they reach the top of the queue
+          QEM_Edge* pair = smallest_error_edge;
+          pair->edge = FindLiveEdge(pair->edge);
+          pair->virtual_edge = FindLiveEdge(pair->virtual_edge);
+          if(pair->edge == nullptr || pair->virtual_edge == nullptr ||
+             pair->edge->v->position == pair->virtual_edge->v->position) {
+            pair->edge = nullptr;
+            pair->virtual_edge = nullptr;
+            continue;
+          }
+          Scalar cost = pair->qem;
+          EvaluateCosts(&pair, 1);
+          if(pair->qem > cost) {
+            qem_edges.Push(pair);
+            continue;
+          }
+        } else if(smallest_error_edge->edge->f == nullptr) {
+          continue;
+        }
+        //next_edge_to_collapse = std::make_pair(smalles_error_edge->edge->v->position, smalles_error_edge->edge->next_edge->next_edge->v->position);
+        next_edge_to_collapse = std::make_pair(smallest_error_edge->edge->v->position, smallest_error_edge->FirstVertex()->position);
+        return true;
+      }
+      smallest_error_edge = nullptr;
+      return false;
+    }
+    // An edge pointing to the same vertex of e (in the same fan) that still
+    // has a face: the removed edges keep their links, so the fan is followed
+    // from e to the faces that were connected by the collapses
+    static HalfEdge* FindLiveEdge(HalfEdge* e) {
+      for(int step = 0; e != nullptr && e->f == nullptr && step < 16; ++step) {
+        HalfEdge* next = e->next_edge->opposite_edge;
+        HalfEdge* previous = e->opposite_edge != nullptr ? e->opposite_edge->next_edge->next_edge : nullptr;
+        if(next != nullptr && next->f != nullptr) return next;
+        if(previous != nullptr && previous->f != nullptr) return previous;
+        e = next != nullptr ? next : previous;
+      }
+      return e != nullptr && e->f != nullptr ? e : nullptr;
+    }
+    // the two fans of a virtual pair are moved without flipping a face
+    bool IsLocked(QEM_Edge* qem_edge) {
+      if(locked_positions.empty()) return false;
+      return locked_positions.find(qem_edge->FirstVertex()->position) != locked_positions.end() ||
+             locked_positions.find(qem_edge->edge->v->position) != locked_positions.end();
+    }
+    bool IsVirtualPairValid(QEM_Edge* pair) {
+      return mesh_data.IsMoveValid(pair->edge->v, pair->mergePosition) &&
+             mesh_data.IsMoveValid(pair->virtual_edge->v, pair->mergePosition);
+    }
+    // Moves in merge_position the fans of the positions p1 and p2 left by
+    // the virtual pairs (the ones in moved_edges were already moved by the
+    // collapse), adds their faces to the quadric of merge_position and
+    // marks their edges dirty
+    void MoveFans(glm::vec3 p1, glm::vec3 p2, glm::vec3 merge_position, int merged_id) {
+      fans.clear();
+      glm::vec3 positions[2] = {p1, p2};
+      for(auto position : positions) {
+        auto it = virtual_fans.find(position);
+        if(it != virtual_fans.end()) {
+          fans.insert(fans.end(), it->second.begin(), it->second.end());
+          virtual_fans.erase(position);
+        }
+      }
+      if(fans.empty()) return;
+      std::vector<HalfEdge*> merged_fans;
+      if(!moved_edges.empty()) {
+        merged_fans.push_back(moved_edges[0]);
+      }
+      for(auto fan : fans) {
+        fan = FindLiveEdge(fan);
+        // the same fan can be listed more than once
+        if(fan == nullptr || std::find(moved_edges.begin(), moved_edges.end(), fan) != moved_edges.end()) continue;
+        const std::vector<HalfEdge*>& edges_to_new_vertex = mesh_data.MoveVertex(fan, merge_position, merged_id);
+        q_matrices[merge_position] += CalculateQMatrix(edges_to_new_vertex);
+        for(auto edge_to_v : edges_to_new_vertex) {
+          MarkEdgeDirty(edge_to_v);
+          MarkEdgeDirty(edge_to_v->next_edge);
+        }
+        moved_edges.insert(moved_edges.end(), edges_to_new_vertex.begin(), edges_to_new_vertex.end());
+        merged_fans.push_back(fan);
+      }
+      if(merged_fans.size() > 1) {
+        virtual_fans[merge_position].swap(merged_fans);
+      }
+    }
+    // one QEM edge for every edge, shared by the two half-edges, the
+    // smallest one is taken out of the queue
+    void BuildQueue() {
+      for(auto e : mesh_data.edges) {
+        if(e->opposite_edge != nullptr) {
+          auto it = edge_QEM_lookup.find(e->opposite_edge);
+          if(it != edge_QEM_lookup.end()) {
+            edge_QEM_lookup[e] = it->second;
+            continue;
+          }
+        }
+        QEM_Edge* qem_edge = new QEM_Edge(e);
+        qem_edge->order = next_order++;
+        //qem_edges.push_back(qem_edge);
+        //min_heap_QEM.insert(qem_edge);
+        edge_QEM_lookup[e] = qem_edge;
+        dirty_edges.push_back(qem_edge);
+      }
+      EvaluateCosts(dirty_edges.data(), dirty_edges.size());
+      for(auto qem_edge : dirty_edges) {
+        qem_edges.Push(qem_edge);
+      }
+      dirty_edges.clear();
+      //smalles_error_edge = *std::min_element(qem_edges.begin(), qem_edges.end(), [](QEM_Edge* a, QEM_Edge* b) {
+      //    return a->qem < b->qem;
+      //  });
+      //smalles_error_edge = min_heap_QEM.extractMin();
+      PopNextEdge();
+    }
+    // Adds the QEM edge of e to dirty_edges if it is not there yet. The two
+    // sides of a removed triangle are joined by the collapse, their QEM
+    // edges become one (the other one is removed from the queue)
+    void MarkEdgeDirty(HalfEdge* e) {
+      QEM_Edge* qem_edge = edge_QEM_lookup[e];
+      if(e->opposite_edge != nullptr) {
+        QEM_Edge*& opposite = edge_QEM_lookup[e->opposite_edge];
+        if(opposite != qem_edge) {
+          if(opposite->dirty) {
+            // the opposite side was marked first, it keeps its QEM edge
+            qem_edges.Remove(qem_edge);
+            delete qem_edge;
+            edge_QEM_lookup[e] = opposite;
+            return;
+          }
+          qem_edges.Remove(opposite);
+          delete opposite;
+          opposite = qem_edge;
+        }
+      }
+      if(!qem_edge->dirty) {
+        qem_edge->dirty = true;
+        qem_edge->edge = e;
+        dirty_edges.push_back(qem_edge);
+      }
+    }
+    // Re-costs the dirty edges in a single pass with the new quadrics (the
+    // edges skipped as not valid are not in the queue, they are added again)
+    void UpdateDirtyEdges() {
+      for(auto qem_edge : dirty_edges) {
+        qem_edges.Remove(qem_edge);
+      }
+      EvaluateCosts(dirty_edges.data(), dirty_edges.size());
+      for(auto qem_edge : dirty_edges) {
+        qem_edge->dirty = false;
+      }
+      for(auto qem_edge : dirty_edges) {
+        qem_edges.Push(qem_edge);
+      }
+    }
+    // cost and merge position of the edges with the batch (SIMD) evaluation
+    void EvaluateCosts(QEM_Edge* const* qem_edges_to_update, std::size_t count) {
+      cost_batch.Clear();
+      for(std::size_t i = 0; i < count; ++i) {
+        glm::vec3 p1 = qem_edges_to_update[i]->FirstVertex()->position;
+        glm::vec3 p2 = qem_edges_to_update[i]->edge->v->position;
+        Quadric Q = VertexQuadric(qem_edges_to_update[i]->FirstVertex());
+        Q += VertexQuadric(qem_edges_to_update[i]->edge->v);
+        cost_batch.Add(Q, p1, p2);
+      }
+      cost_batch.Evaluate();
+      for(std::size_t i = 0; i < count; ++i) {
+        qem_edges_to_update[i]->SetMergePosition(cost_batch.MergePosition(i), cost_batch.Error(i));
+      }
+    }
+    // Quadric of the vertex v, copied: the quadrics are in a hash map, so a
+    // reference could dangle after the next insertion. The quadrics are shared
+    // by position, so when a vertex at the same position of v (e.g. the other
+    // corner of a split non-manifold vertex) is collapsed the quadric of v is
+    // erased too, then it's computed again from the faces of v
+    Quadric VertexQuadric(HalfEdgeVertex* v) {
+      auto it = q_matrices.find(v->position);
+      if(it != q_matrices.end()) {
+        return it->second;
+      }
+      Quadric Q = Quadric(0);
+      for(auto e : v->IncomingEdges()) {
+        Q += CalculateFaceQuadric(e);
+      }
+      q_matrices[v->position] = Q;
+      return Q;
+    }
+    Quadric CalculateQMatrix(const std::vector<HalfEdge*>& edges) {
+      Quadric Q = Quadric(0);
       for(auto e : edges) {
-        glm::vec3 p1 = e->v->position;
-        glm::vec3 p2 = e->next_edge->v->position;
-        glm::vec3 p3 = e->next_edge->next_edge->v->position;
-        glm::vec3 normal = glm::normalize(glm::cross(p2 - p1, p3 - p1));
-        if(std::isnan(normal.x) || std::isnan(normal.y) || std::isnan(normal.z)) {
-          normal = glm::vec3(0.0f, 0.0f, 0.0f);
-        }
-        float a = normal.x;
-        float b = normal.y;
-        float c = normal.z;
-        float d = -(a*p1.x + b*p1.y + c*p1.z);
-        glm::mat4 Kp = glm::mat4(a*a, a*b, a*c, a*d,
+        Q += CalculateFaceQuadric(e);
+      }
+      return Q;
+    }
+    // fundamental error quadric of the plane of the face of the edge (the
+    // planes are cached by the mesh)
+    Quadric CalculateFaceQuadric(HalfEdge* e) {
+        glm::vec3 normal = mesh_data.FaceNormal(e->f);
+        Scalar a = normal.x;
+        Scalar b = normal.y;
+        Scalar c = normal.z;
+        Scalar d = mesh_data.FaceOffset(e->f);
+        Quadric Kp = Quadric(a*a, a*b, a*c, a*d,
                                   a*b, b*b, b*c, b*d,
                                   a*c, b*c, c*c, c*d,
                                   a*d, b*d, c*d, d*d);
-        Q += Kp;
-      }
-      return Q;
+        return Kp;
     }
 };
+typedef BasicMeshSimplification_QEM<float> MeshSimplification_QEM;
+typedef BasicMeshSimplification_QEM<double> MeshSimplification_QEM_Double;
+typedef BasicMeshSimplification_QEM<float, BucketEdgeQueue<QEM_Edge>> MeshSimplification_QEM_Bucketed;
 } // namespace my_structs
\ No newline at end of file
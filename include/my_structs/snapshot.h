@@ -0,0 +1,342 @@
+#pragma once
+#include <my_structs/halfedgedata.h>
+#include <my_structs/flat_hash_map.h>
+#include <my_structs/mapped_file.h>
+#include <my_structs/content_hash.h>
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace my_structs {
+// Layout of the snapshot file: the header followed by the arrays, every array
+// starts at the offset written in the header. The links between the elements
+// are indices in the arrays (the largest index for a missing opposite edge).
+// The width of the indices is chosen by the size of the mesh (16 bits for the
+// small meshes, 64 bits for the huge ones) and the quadrics keep the scalar of
+// the simplification that saved them. The header records also where the
+// mesh comes from (see SnapshotSource)
+const std::uint32_t kSnapshotVersion = 3;
+
+// The file the mesh was imported from and how: a snapshot saved with a
+// source is loaded only if the source is still the same (e.g. the OBJ
+// hasn't been edited and the weld tolerance hasn't changed)
+struct SnapshotSource {
+  // hash of the content of the source file (0 if there is no source)
+  std::uint64_t fingerprint{0};
+  // hash of the parameters of the import
+  std::uint64_t parameters{0};
+};
+inline SnapshotSource MakeSnapshotSource(const std::string& source_path, float weld_tolerance, bool reordered) {
+  SnapshotSource source;
+  source.fingerprint = HashFileContent(source_path);
+  ContentHash parameters;
+  parameters.Add(weld_tolerance);
+  std::uint8_t reorder = reordered ? 1 : 0;
+  parameters.Add(reorder);
+  source.parameters = parameters.Value();
+  return source;
+}
+struct SnapshotHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t index_size;
+  std::uint32_t quadric_scalar_size;
+  std::uint32_t padding;
+  std::uint64_t vertex_count;
+  std::uint64_t face_count;
+  std::uint64_t edge_count;
+  std::uint64_t quadric_count;
+  std::uint64_t vertex_ids;
+  std::uint64_t non_manifold_edges;
+  std::uint64_t non_manifold_vertices;
+  std::uint64_t source_fingerprint;
+  std::uint64_t source_parameters;
+  std::uint64_t vertices_offset;
+  std::uint64_t faces_offset;
+  std::uint64_t edges_offset;
+  std::uint64_t quadrics_offset;
+};
+template <typename Index>
+struct SnapshotVertex {
+  float position[3];
+  float normal[3];
+  std::int32_t id;
+  Index edge;
+};
+template <typename Index>
+struct SnapshotEdge {
+  Index v;
+  Index f;
+  Index next_edge;
+  Index opposite_edge;
+};
+template <typename Index>
+struct SnapshotFace {
+  Index edge;
+};
+template <typename Scalar>
+struct SnapshotQuadric {
+  float position[3];
+  Scalar q[16];
+};
+
+namespace snapshot_detail {
+// every array starts at a multiple of 8 bytes, so the mapped elements are aligned
+inline std::uint64_t Align(std::uint64_t offset) {
+  return (offset + 7) & ~std::uint64_t(7);
+}
+inline void Pad(std::ofstream& out, std::uint64_t offset) {
+  static const char zeros[8] = {0};
+  out.write(zeros, Align(offset) - offset);
+}
+template <typename Index, typename Quadric>
+bool Write(const std::string& path, const HalfEdgeMesh& mesh, const FlatHashMap<glm::vec3, Quadric>* quadrics,
+           const SnapshotSource& source) {
+  typedef typename Quadric::value_type Scalar;
+  const Index no_index = std::numeric_limits<Index>::max();
+  FlatHashMap<HalfEdgeVertex*, Index> vertex_index;
+  FlatHashMap<HalfEdgeFace*, Index> face_index;
+  FlatHashMap<HalfEdge*, Index> edge_index;
+  vertex_index.reserve(mesh.vertices.size());
+  face_index.reserve(mesh.faces.size());
+  edge_index.reserve(mesh.edges.size());
+  for (std::size_t i = 0; i < mesh.vertices.size(); ++i) vertex_index[mesh.vertices[i]] = static_cast<Index>(i);
+  for (std::size_t i = 0; i < mesh.faces.size(); ++i) face_index[mesh.faces[i]] = static_cast<Index>(i);
+  for (std::size_t i = 0; i < mesh.edges.size(); ++i) edge_index[mesh.edges[i]] = static_cast<Index>(i);
+
+  SnapshotHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "HEMESH", 6);
+  header.version = kSnapshotVersion;
+  header.index_size = sizeof(Index);
+  header.quadric_scalar_size = sizeof(Scalar);
+  header.vertex_count = mesh.vertices.size();
+  header.face_count = mesh.faces.size();
+  header.edge_count = mesh.edges.size();
+  header.quadric_count = quadrics != nullptr ? quadrics->size() : 0;
+  header.vertex_ids = mesh.vertex_count;
+  header.non_manifold_edges = mesh.manifold_report.non_manifold_edges;
+  header.non_manifold_vertices = mesh.manifold_report.non_manifold_vertices;
+  header.source_fingerprint = source.fingerprint;
+  header.source_parameters = source.parameters;
+  header.vertices_offset = Align(sizeof(SnapshotHeader));
+  header.faces_offset = Align(header.vertices_offset + header.vertex_count * sizeof(SnapshotVertex<Index>));
+  header.edges_offset = Align(header.faces_offset + header.face_count * sizeof(SnapshotFace<Index>));
+  header.quadrics_offset = Align(header.edges_offset + header.edge_count * sizeof(SnapshotEdge<Index>));
+
+  std::vector<SnapshotVertex<Index>> vertices_out(mesh.vertices.size());
+  for (std::size_t i = 0; i < mesh.vertices.size(); ++i) {
+    HalfEdgeVertex* v = mesh.vertices[i];
+    std::memcpy(vertices_out[i].position, &v->position[0], sizeof(vertices_out[i].position));
+    std::memcpy(vertices_out[i].normal, &v->normal[0], sizeof(vertices_out[i].normal));
+    vertices_out[i].id = v->id;
+    vertices_out[i].edge = edge_index[v->edge];
+  }
+  std::vector<SnapshotFace<Index>> faces_out(mesh.faces.size());
+  for (std::size_t i = 0; i < mesh.faces.size(); ++i) {
+    faces_out[i].edge = edge_index[mesh.faces[i]->edge];
+  }
+  std::vector<SnapshotEdge<Index>> edges_out(mesh.edges.size());
+  for (std::size_t i = 0; i < mesh.edges.size(); ++i) {
+    HalfEdge* e = mesh.edges[i];
+    edges_out[i].v = vertex_index[e->v];
+    edges_out[i].f = face_index[e->f];
+    edges_out[i].next_edge = edge_index[e->next_edge];
+    edges_out[i].opposite_edge = e->opposite_edge != nullptr ? edge_index[e->opposite_edge] : no_index;
+  }
+  std::vector<SnapshotQuadric<Scalar>> quadrics_out;
+  if (quadrics != nullptr) {
+    quadrics_out.reserve(quadrics->size());
+    for (auto& item : *quadrics) {
+      SnapshotQuadric<Scalar> quadric;
+      std::memcpy(quadric.position, &item.first[0], sizeof(quadric.position));
+      std::memcpy(quadric.q, &item.second[0][0], sizeof(quadric.q));
+      quadrics_out.push_back(quadric);
+    }
+  }
+
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  if (!out) return false;
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  Pad(out, sizeof(header));
+  out.write(reinterpret_cast<const char*>(vertices_out.data()), vertices_out.size() * sizeof(vertices_out[0]));
+  Pad(out, header.vertices_offset + vertices_out.size() * sizeof(vertices_out[0]));
+  out.write(reinterpret_cast<const char*>(faces_out.data()), faces_out.size() * sizeof(faces_out[0]));
+  Pad(out, header.faces_offset + faces_out.size() * sizeof(faces_out[0]));
+  out.write(reinterpret_cast<const char*>(edges_out.data()), edges_out.size() * sizeof(edges_out[0]));
+  Pad(out, header.edges_offset + edges_out.size() * sizeof(edges_out[0]));
+  out.write(reinterpret_cast<const char*>(quadrics_out.data()), quadrics_out.size() * sizeof(SnapshotQuadric<Scalar>));
+  return static_cast<bool>(out);
+}
+
+// checks the offsets of the arrays against the counts in the header
+template <typename Index>
+bool ValidOffsets(const SnapshotHeader& header) {
+  return header.vertices_offset == Align(sizeof(SnapshotHeader)) &&
+         header.faces_offset == Align(header.vertices_offset + header.vertex_count * sizeof(SnapshotVertex<Index>)) &&
+         header.edges_offset == Align(header.faces_offset + header.face_count * sizeof(SnapshotFace<Index>)) &&
+         header.quadrics_offset == Align(header.edges_offset + header.edge_count * sizeof(SnapshotEdge<Index>));
+}
+
+// checks every index of the file against the count of the elements it refers
+// to (only the opposite of a boundary edge can be missing), so a damaged or
+// crafted snapshot can't make Link read or link outside of the arrays
+template <typename Index>
+bool ValidIndices(const unsigned char* data, const SnapshotHeader& header) {
+  const Index no_index = std::numeric_limits<Index>::max();
+  const SnapshotVertex<Index>* vertices_in = reinterpret_cast<const SnapshotVertex<Index>*>(data + header.vertices_offset);
+  const SnapshotFace<Index>* faces_in = reinterpret_cast<const SnapshotFace<Index>*>(data + header.faces_offset);
+  const SnapshotEdge<Index>* edges_in = reinterpret_cast<const SnapshotEdge<Index>*>(data + header.edges_offset);
+  for (std::uint64_t i = 0; i < header.vertex_count; ++i) {
+    if (vertices_in[i].edge >= header.edge_count) return false;
+    if (vertices_in[i].id < 0 || static_cast<std::uint64_t>(vertices_in[i].id) >= header.vertex_ids) return false;
+  }
+  for (std::uint64_t i = 0; i < header.face_count; ++i) {
+    if (faces_in[i].edge >= header.edge_count) return false;
+  }
+  for (std::uint64_t i = 0; i < header.edge_count; ++i) {
+    const SnapshotEdge<Index>& in = edges_in[i];
+    if (in.v >= header.vertex_count || in.f >= header.face_count || in.next_edge >= header.edge_count) return false;
+    if (in.opposite_edge != no_index && in.opposite_edge >= header.edge_count) return false;
+  }
+  return true;
+}
+
+template <typename Index>
+void Link(const unsigned char* data, const SnapshotHeader& header, HalfEdgeMesh& mesh) {
+  const Index no_index = std::numeric_limits<Index>::max();
+  const SnapshotVertex<Index>* vertices_in = reinterpret_cast<const SnapshotVertex<Index>*>(data + header.vertices_offset);
+  const SnapshotFace<Index>* faces_in = reinterpret_cast<const SnapshotFace<Index>*>(data + header.faces_offset);
+  const SnapshotEdge<Index>* edges_in = reinterpret_cast<const SnapshotEdge<Index>*>(data + header.edges_offset);
+  mesh.vertices.reserve(header.vertex_count);
+  mesh.faces.reserve(header.face_count);
+  mesh.edges.reserve(header.edge_count);
+  for (std::uint64_t i = 0; i < header.vertex_count; ++i) {
+    const SnapshotVertex<Index>& in = vertices_in[i];
+    HalfEdgeVertex* v = new HalfEdgeVertex(glm::vec3(in.position[0], in.position[1], in.position[2]),
+                                           glm::vec3(in.normal[0], in.normal[1], in.normal[2]));
+    v->id = in.id;
+    mesh.vertices.push_back(v);
+  }
+  for (std::uint64_t i = 0; i < header.face_count; ++i) {
+    mesh.faces.push_back(new HalfEdgeFace(nullptr));
+  }
+  for (std::uint64_t i = 0; i < header.edge_count; ++i) {
+    mesh.edges.push_back(new HalfEdge(mesh.vertices[edges_in[i].v]));
+  }
+  for (std::uint64_t i = 0; i < header.edge_count; ++i) {
+    const SnapshotEdge<Index>& in = edges_in[i];
+    HalfEdge* e = mesh.edges[i];
+    e->f = mesh.faces[in.f];
+    e->next_edge = mesh.edges[in.next_edge];
+    e->opposite_edge = in.opposite_edge != no_index ? mesh.edges[in.opposite_edge] : nullptr;
+  }
+  for (std::uint64_t i = 0; i < header.vertex_count; ++i) {
+    mesh.vertices[i]->edge = mesh.edges[vertices_in[i].edge];
+  }
+  for (std::uint64_t i = 0; i < header.face_count; ++i) {
+    mesh.faces[i]->edge = mesh.edges[faces_in[i].edge];
+  }
+}
+
+template <typename Stored, typename Quadric>
+void ReadQuadrics(const unsigned char* data, const SnapshotHeader& header, FlatHashMap<glm::vec3, Quadric>& quadrics) {
+  typedef typename Quadric::value_type Scalar;
+  const SnapshotQuadric<Stored>* quadrics_in = reinterpret_cast<const SnapshotQuadric<Stored>*>(data + header.quadrics_offset);
+  quadrics.reserve(header.quadric_count);
+  for (std::uint64_t i = 0; i < header.quadric_count; ++i) {
+    Quadric q;
+    for (int j = 0; j < 16; ++j) {
+      q[j / 4][j % 4] = static_cast<Scalar>(quadrics_in[i].q[j]);
+    }
+    quadrics[glm::vec3(quadrics_in[i].position[0], quadrics_in[i].position[1], quadrics_in[i].position[2])] = q;
+  }
+}
+}  // namespace snapshot_detail
+
+// Writes the mesh with its connectivity, (if given) the quadrics of the
+// vertices of the simplification and the source of the mesh. Returns false
+// if the file can't be written
+template <typename Quadric = glm::mat4>
+bool SaveSnapshot(const std::string& path, const HalfEdgeMesh& mesh,
+                  const FlatHashMap<glm::vec3, Quadric>* quadrics = nullptr,
+                  const SnapshotSource& source = SnapshotSource()) {
+  std::size_t largest = std::max(mesh.edges.size(), std::max(mesh.vertices.size(), mesh.faces.size()));
+  if (largest < std::numeric_limits<std::uint16_t>::max()) {
+    return snapshot_detail::Write<std::uint16_t>(path, mesh, quadrics, source);
+  }
+  if (largest < std::numeric_limits<std::uint32_t>::max()) {
+    return snapshot_detail::Write<std::uint32_t>(path, mesh, quadrics, source);
+  }
+  return snapshot_detail::Write<std::uint64_t>(path, mesh, quadrics, source);
+}
+
+// Maps the snapshot and links the elements of the (empty) mesh through the
+// indices stored in the file: no parsing, no hashing and no pairing of the
+// edges. The quadrics are copied in quadrics (converted to its scalar).
+// Returns false if the file is missing or not valid, or if source is given
+// and the snapshot was saved from a different source
+template <typename Quadric>
+bool LoadSnapshot(const std::string& path, HalfEdgeMesh& mesh, FlatHashMap<glm::vec3, Quadric>& quadrics,
+                  const SnapshotSource* source = nullptr) {
+  MappedFile file(path);
+  if (!file.IsOpen() || file.Size() < sizeof(SnapshotHeader)) return false;
+  SnapshotHeader header;
+  std::memcpy(&header, file.Data(), sizeof(header));
+  bool valid = std::memcmp(header.magic, "HEMESH", 6) == 0 && header.version == kSnapshotVersion;
+  // every element takes more than one byte, larger counts would overflow the offsets
+  valid = valid && header.vertex_count < file.Size() && header.face_count < file.Size() &&
+          header.edge_count < file.Size() && header.quadric_count < file.Size();
+  if (valid) {
+    switch (header.index_size) {
+      case 2: valid = snapshot_detail::ValidOffsets<std::uint16_t>(header); break;
+      case 4: valid = snapshot_detail::ValidOffsets<std::uint32_t>(header); break;
+      case 8: valid = snapshot_detail::ValidOffsets<std::uint64_t>(header); break;
+      default: valid = false;
+    }
+  }
+  std::uint64_t quadric_size = header.quadric_scalar_size == 8 ? sizeof(SnapshotQuadric<double>) : sizeof(SnapshotQuadric<float>);
+  valid = valid && (header.quadric_scalar_size == 4 || header.quadric_scalar_size == 8) &&
+          header.quadrics_offset + header.quadric_count * quadric_size == file.Size();
+  if (valid) {
+    switch (header.index_size) {
+      case 2: valid = snapshot_detail::ValidIndices<std::uint16_t>(file.Data(), header); break;
+      case 4: valid = snapshot_detail::ValidIndices<std::uint32_t>(file.Data(), header); break;
+      default: valid = snapshot_detail::ValidIndices<std::uint64_t>(file.Data(), header); break;
+    }
+  }
+  if (!valid) {
+    std::cout << "LoadSnapshot: " << path << " is not a valid snapshot" << std::endl;
+    return false;
+  }
+  if (source != nullptr && (header.source_fingerprint != source->fingerprint ||
+                            header.source_parameters != source->parameters)) {
+    std::cout << "LoadSnapshot: " << path << " was saved from a different source, it is ignored" << std::endl;
+    return false;
+  }
+  switch (header.index_size) {
+    case 2: snapshot_detail::Link<std::uint16_t>(file.Data(), header, mesh); break;
+    case 4: snapshot_detail::Link<std::uint32_t>(file.Data(), header, mesh); break;
+    default: snapshot_detail::Link<std::uint64_t>(file.Data(), header, mesh); break;
+  }
+  mesh.vertex_count = header.vertex_ids;
+  mesh.manifold_report.non_manifold_edges = header.non_manifold_edges;
+  mesh.manifold_report.non_manifold_vertices = header.non_manifold_vertices;
+  mesh.ComputeFacePlanes();
+
+  quadrics.clear();
+  if (header.quadric_scalar_size == 8) {
+    snapshot_detail::ReadQuadrics<double>(file.Data(), header, quadrics);
+  } else {
+    snapshot_detail::ReadQuadrics<float>(file.Data(), header, quadrics);
+  }
+  return true;
+}
+}  // namespace my_structs
@@ -0,0 +1,87 @@
+#pragma once
+#include <my_structs/halfedgedata.h>
+#include <my_structs/simplification.h>
+#include <my_structs/streaming.h>
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace my_structs {
+struct StreamedSimplificationOptions {
+  // faces kept of every chunk, as a fraction of its faces
+  float target_ratio{0.5f};
+  // no collapse with a greater error is done, even if the target isn't reached
+  float max_error{std::numeric_limits<float>::infinity()};
+};
+
+struct StreamedSimplificationResult {
+  std::size_t chunks{0};
+  std::size_t faces_before{0};
+  std::size_t faces_after{0};
+  // end points of the seam half-edges, locked in their chunk
+  std::size_t locked_vertices{0};
+  // false if a chunk stopped before its target (max_error, too few faces
+  // or no valid edge left)
+  bool reached_target{true};
+  bool written{false};
+};
+
+// Simplifies the chunked mesh file one chunk at a time, so only one chunk is
+// in memory, and writes the result in the OBJ file output (positions and
+// faces). The vertices on the seams between the chunks are locked, so the
+// chunks still meet at the same positions after the simplification: the
+// seams keep their faces, the inside of the chunks is simplified
+template <typename Simplification = MeshSimplification_QEM>
+StreamedSimplificationResult SimplifyStreamedMesh(const StreamedMesh& streamed, const std::string& output,
+                                                  const StreamedSimplificationOptions& options = StreamedSimplificationOptions()) {
+  StreamedSimplificationResult result;
+  if (!streamed.IsValid()) return result;
+  FILE* out = std::fopen(output.c_str(), "w");
+  if (out == nullptr) return result;
+  result.chunks = streamed.ChunkCount();
+  // the OBJ indices are global, every chunk writes its own vertices
+  std::size_t written_vertices = 0;
+  std::vector<glm::vec3> seam_positions;
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  for (std::size_t chunk = 0; chunk < result.chunks; ++chunk) {
+    HalfEdgeMesh mesh;
+    seam_positions.clear();
+    streamed.LoadChunk(chunk, mesh, &seam_positions);
+    result.faces_before += mesh.faces.size();
+    std::size_t target = static_cast<std::size_t>(options.target_ratio * mesh.faces.size());
+    {
+      Simplification simplification(mesh);
+      for (auto& position : seam_positions) {
+        simplification.LockVertex(position);
+      }
+      result.locked_vertices += simplification.locked_positions.size();
+      while (mesh.faces.size() > target) {
+        // a collapse removes two faces
+        int collapses = static_cast<int>(std::max<std::size_t>(1, (mesh.faces.size() - target) / 2));
+        if (!simplification.SimplifyMesh(collapses, options.max_error)) {
+          result.reached_target = false;
+          break;
+        }
+      }
+    }
+    result.faces_after += mesh.faces.size();
+    mesh.ConvertToBuffers(vertices, indices, true);
+    for (auto& vertex : vertices) {
+      std::fprintf(out, "v %.9g %.9g %.9g\n", vertex.Position.x, vertex.Position.y, vertex.Position.z);
+    }
+    for (std::size_t i = 0; i + 2 < indices.size(); i += 3) {
+      std::fprintf(out, "f %zu %zu %zu\n", written_vertices + indices[i] + 1, written_vertices + indices[i + 1] + 1,
+                   written_vertices + indices[i + 2] + 1);
+    }
+    written_vertices += vertices.size();
+  }
+  result.written = std::fclose(out) == 0;
+  return result;
+}
+}  // namespace my_structs
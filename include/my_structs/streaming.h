@@ -0,0 +1,438 @@
+#pragma once
+#include <my_structs/halfedgedata.h>
+#include <my_structs/flat_hash_map.h>
+#include <my_structs/external_sort.h>
+#include <my_structs/mapped_file.h>
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace my_structs {
+// Source of the triangles of the streaming builder, read once from the start
+class TriangleSource {
+ public:
+  virtual ~TriangleSource() = default;
+  // writes the three corners of the next triangle, false at the end
+  virtual bool Next(glm::vec3* corners) = 0;
+};
+
+// Triangles of a Mesh (or of anything with the vertices and indices
+// buffers) already in memory
+class MeshTriangleSource : public TriangleSource {
+ public:
+  template <typename MeshBuffers>
+  MeshTriangleSource(const MeshBuffers& mesh) : vertices(mesh.vertices), indices(mesh.indices) {}
+  bool Next(glm::vec3* corners) override {
+    if (next + 2 >= indices.size()) return false;
+    for (int k = 0; k < 3; ++k) {
+      corners[k] = vertices[indices[next + k]].Position;
+    }
+    next += 3;
+    return true;
+  }
+
+ private:
+  const std::vector<Vertex>& vertices;
+  const std::vector<unsigned int>& indices;
+  std::size_t next{0};
+};
+
+// Triangles of an OBJ file (polygons are split in fans). The positions are
+// copied in a temporary file next to the OBJ and mapped, so only the pages of
+// the positions used by the current faces need to be in memory
+class ObjTriangleSource : public TriangleSource {
+ public:
+  ObjTriangleSource(const std::string& path, const std::string& positions_path)
+      : positions_path(positions_path) {
+    {
+      std::ifstream in(path);
+      RecordWriter<glm::vec3> writer(positions_path);
+      std::string line;
+      while (std::getline(in, line)) {
+        if (line.size() > 2 && line[0] == 'v' && line[1] == ' ') {
+          glm::vec3 p(0.0f);
+          std::sscanf(line.c_str() + 2, "%f %f %f", &p.x, &p.y, &p.z);
+          writer.Write(p);
+          ++position_count;
+        }
+      }
+    }
+    positions.reset(new MappedFile(positions_path));
+    faces.open(path);
+  }
+  ~ObjTriangleSource() override {
+    positions.reset();
+    std::remove(positions_path.c_str());
+  }
+  bool Next(glm::vec3* corners) override {
+    while (fan_next >= fan.size()) {
+      std::string line;
+      if (!std::getline(faces, line)) return false;
+      if (line.size() < 2 || line[0] != 'f' || line[1] != ' ') continue;
+      // the fan of the polygon: first corner, then every pair of the others
+      std::vector<std::size_t> polygon;
+      std::istringstream corners_in(line.substr(2));
+      std::string corner;
+      while (corners_in >> corner) {
+        long index = std::strtol(corner.c_str(), nullptr, 10);
+        if (index < 0) index += static_cast<long>(position_count) + 1;
+        if (index <= 0 || static_cast<std::size_t>(index) > position_count) break;
+        polygon.push_back(static_cast<std::size_t>(index - 1));
+      }
+      fan.clear();
+      fan_next = 0;
+      for (std::size_t i = 2; i < polygon.size(); ++i) {
+        fan.push_back(polygon[0]);
+        fan.push_back(polygon[i - 1]);
+        fan.push_back(polygon[i]);
+      }
+    }
+    const glm::vec3* data = reinterpret_cast<const glm::vec3*>(positions->Data());
+    for (int k = 0; k < 3; ++k) {
+      corners[k] = data[fan[fan_next + k]];
+    }
+    fan_next += 3;
+    return true;
+  }
+
+ private:
+  std::string positions_path;
+  std::size_t position_count{0};
+  std::unique_ptr<MappedFile> positions;
+  std::ifstream faces;
+  std::vector<std::size_t> fan;
+  std::size_t fan_next{0};
+};
+
+struct StreamingOptions {
+  // memory used by the sorts and by one chunk built as HalfEdgeMesh
+  std::size_t memory_budget{256u << 20};
+  // folder of the temporary files
+  std::string work_dir{"."};
+};
+
+// Layout of the chunked mesh file: the header, the triangles (three corners,
+// sorted along the Morton curve of their centroids) and the opposite of every
+// half-edge as a global half-edge id (3 * triangle + corner, kNoOpposite on
+// the boundary). The half-edge k of a triangle goes from corner k + 2 to
+// corner k, as in HalfEdgeMesh. A chunk is a range of chunk_triangles
+// consecutive triangles, so it covers a compact region of the mesh
+const std::uint32_t kStreamedMeshVersion = 1;
+const std::uint64_t kNoOpposite = std::numeric_limits<std::uint64_t>::max();
+struct StreamedMeshHeader {
+  char magic[8];
+  std::uint32_t version;
+  std::uint32_t padding;
+  std::uint64_t triangle_count;
+  std::uint64_t chunk_triangles;
+  std::uint64_t non_manifold_edges;
+  std::uint64_t triangles_offset;
+  std::uint64_t opposites_offset;
+  float min[3];
+  float max[3];
+};
+struct StreamedTriangle {
+  glm::vec3 corners[3];
+};
+
+namespace streaming_detail {
+struct MortonRecord {
+  std::uint32_t key;
+  std::uint32_t padding;
+  std::uint64_t triangle;
+};
+// an undirected edge as the bits of its two end points (the smaller first)
+struct EdgeRecord {
+  std::uint32_t a[3];
+  std::uint32_t b[3];
+  // 1 if the half-edge goes from a to b
+  std::uint32_t forward;
+  std::uint32_t padding;
+  std::uint64_t half_edge;
+};
+struct OppositeRecord {
+  std::uint64_t half_edge;
+  std::uint64_t opposite;
+};
+inline void PositionBits(const glm::vec3& p, std::uint32_t* bits) {
+  std::memcpy(bits, &p[0], 3 * sizeof(std::uint32_t));
+}
+inline bool SameEdge(const EdgeRecord& x, const EdgeRecord& y) {
+  return std::memcmp(x.a, y.a, sizeof(x.a)) == 0 && std::memcmp(x.b, y.b, sizeof(x.b)) == 0;
+}
+inline std::uint64_t Align(std::uint64_t offset) {
+  return (offset + 7) & ~std::uint64_t(7);
+}
+}  // namespace streaming_detail
+
+// Builds the chunked mesh file output from source, keeping the memory used
+// around options.memory_budget: the triangles go to disk, the Morton order and
+// the pairing of the half-edges are done with external sorts, and the
+// triangles are read back through memory mappings. Returns false if a file
+// can't be written
+inline bool BuildStreamedMesh(TriangleSource& source, const std::string& output, const StreamingOptions& options = StreamingOptions()) {
+  using namespace streaming_detail;
+  std::string prefix = options.work_dir + "/" + std::to_string(std::hash<std::string>()(output)) + ".";
+  std::string soup_path = prefix + "soup";
+  std::size_t budget = std::max<std::size_t>(options.memory_budget, 1 << 20);
+
+  // 1. the (not degenerate) triangles are written as they come, with the box
+  StreamedMeshHeader header;
+  std::memset(&header, 0, sizeof(header));
+  std::memcpy(header.magic, "HESTREAM", 8);
+  header.version = kStreamedMeshVersion;
+  glm::vec3 min(std::numeric_limits<float>::max()), max(-std::numeric_limits<float>::max());
+  {
+    RecordWriter<StreamedTriangle> writer(soup_path);
+    if (!writer.IsOpen()) return false;
+    StreamedTriangle triangle;
+    while (source.Next(triangle.corners)) {
+      glm::vec3* c = triangle.corners;
+      if (c[0] == c[1] || c[1] == c[2] || c[2] == c[0]) continue;
+      for (int k = 0; k < 3; ++k) {
+        min = glm::min(min, c[k]);
+        max = glm::max(max, c[k]);
+      }
+      writer.Write(triangle);
+      ++header.triangle_count;
+    }
+  }
+  for (int axis = 0; axis < 3; ++axis) {
+    header.min[axis] = min[axis];
+    header.max[axis] = max[axis];
+  }
+  // a chunk must fit in the budget once built as HalfEdgeMesh (about 512
+  // bytes for every triangle with its vertices, edges and face)
+  header.chunk_triangles = std::max<std::uint64_t>(1024, budget / 512);
+  header.triangles_offset = Align(sizeof(StreamedMeshHeader));
+  header.opposites_offset = Align(header.triangles_offset + header.triangle_count * sizeof(StreamedTriangle));
+
+  // 2. Morton order of the centroids
+  std::string keys_path = prefix + "keys";
+  {
+    RecordReader<StreamedTriangle> reader(soup_path);
+    RecordWriter<MortonRecord> writer(keys_path);
+    StreamedTriangle triangle;
+    MortonRecord record;
+    record.padding = 0;
+    record.triangle = 0;
+    while (reader.Next(triangle)) {
+      glm::vec3 centroid = (triangle.corners[0] + triangle.corners[1] + triangle.corners[2]) / 3.0f;
+      record.key = MortonCode(centroid, min, max);
+      writer.Write(record);
+      ++record.triangle;
+    }
+  }
+  if (!ExternalSort<MortonRecord>(keys_path, keys_path + ".sorted", budget, [](const MortonRecord& x, const MortonRecord& y) {
+        return x.key < y.key || (x.key == y.key && x.triangle < y.triangle);
+      })) {
+    return false;
+  }
+  std::remove(keys_path.c_str());
+  {
+    std::ofstream out(output, std::ios::binary | std::ios::trunc);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    static const char zeros[8] = {0};
+    out.write(zeros, header.triangles_offset - sizeof(header));
+    out.close();
+    MappedFile soup(soup_path);
+    const StreamedTriangle* triangles = reinterpret_cast<const StreamedTriangle*>(soup.Data());
+    RecordReader<MortonRecord> reader(keys_path + ".sorted");
+    RecordWriter<StreamedTriangle> writer(output, 1 << 16, std::ios::binary | std::ios::app);
+    MortonRecord record;
+    while (reader.Next(record)) {
+      writer.Write(triangles[record.triangle]);
+    }
+  }
+  std::remove((keys_path + ".sorted").c_str());
+  std::remove(soup_path.c_str());
+
+  // 3. pairing: the half-edges sorted by undirected edge are next to their opposite
+  std::string edges_path = prefix + "edges";
+  std::string opposites_path = prefix + "opposites";
+  {
+    MappedFile sorted(output);
+    if (!sorted.IsOpen() && header.triangle_count > 0) return false;
+    const StreamedTriangle* triangles = reinterpret_cast<const StreamedTriangle*>(sorted.Data() + header.triangles_offset);
+    RecordWriter<EdgeRecord> writer(edges_path);
+    for (std::uint64_t t = 0; t < header.triangle_count; ++t) {
+      for (int k = 0; k < 3; ++k) {
+        std::uint32_t from[3], to[3];
+        PositionBits(triangles[t].corners[(k + 2) % 3], from);
+        PositionBits(triangles[t].corners[k], to);
+        EdgeRecord record;
+        record.forward = std::lexicographical_compare(from, from + 3, to, to + 3) ? 1 : 0;
+        std::memcpy(record.a, record.forward ? from : to, sizeof(record.a));
+        std::memcpy(record.b, record.forward ? to : from, sizeof(record.b));
+        record.padding = 0;
+        record.half_edge = t * 3 + k;
+        writer.Write(record);
+      }
+    }
+  }
+  if (!ExternalSort<EdgeRecord>(edges_path, edges_path + ".sorted", budget, [](const EdgeRecord& x, const EdgeRecord& y) {
+        int c = std::memcmp(x.a, y.a, sizeof(x.a));
+        if (c == 0) c = std::memcmp(x.b, y.b, sizeof(x.b));
+        if (c != 0) {
+          // memcmp is not the numeric order of the bits, but any total order works
+          return c < 0;
+        }
+        return x.half_edge < y.half_edge;
+      })) {
+    return false;
+  }
+  std::remove(edges_path.c_str());
+  {
+    RecordReader<EdgeRecord> reader(edges_path + ".sorted");
+    RecordWriter<OppositeRecord> writer(opposites_path);
+    std::vector<EdgeRecord> group;
+    EdgeRecord record;
+    bool more = reader.Next(record);
+    while (more) {
+      group.clear();
+      group.push_back(record);
+      while ((more = reader.Next(record)) && SameEdge(record, group[0])) {
+        group.push_back(record);
+      }
+      // only two half-edges with opposite directions are paired, like in
+      // HalfEdgeMesh the other ones stay on the boundary
+      if (group.size() == 2 && group[0].forward != group[1].forward) {
+        writer.Write(OppositeRecord{group[0].half_edge, group[1].half_edge});
+        writer.Write(OppositeRecord{group[1].half_edge, group[0].half_edge});
+      } else if (group.size() > 1) {
+        ++header.non_manifold_edges;
+      }
+    }
+  }
+  std::remove((edges_path + ".sorted").c_str());
+  if (!ExternalSort<OppositeRecord>(opposites_path, opposites_path + ".sorted", budget,
+                                    [](const OppositeRecord& x, const OppositeRecord& y) { return x.half_edge < y.half_edge; })) {
+    return false;
+  }
+  std::remove(opposites_path.c_str());
+  {
+    std::fstream out(output, std::ios::binary | std::ios::in | std::ios::out);
+    if (!out) return false;
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    out.seekp(0, std::ios::end);
+    static const char zeros[8] = {0};
+    out.write(zeros, header.opposites_offset - (header.triangles_offset + header.triangle_count * sizeof(StreamedTriangle)));
+    out.close();
+    RecordReader<OppositeRecord> reader(opposites_path + ".sorted");
+    RecordWriter<std::uint64_t> writer(output, 1 << 16, std::ios::binary | std::ios::app);
+    OppositeRecord record;
+    bool more = reader.Next(record);
+    for (std::uint64_t h = 0; h < header.triangle_count * 3; ++h) {
+      if (more && record.half_edge == h) {
+        writer.Write(record.opposite);
+        more = reader.Next(record);
+      } else {
+        writer.Write(kNoOpposite);
+      }
+    }
+    if (!writer.Good()) return false;
+  }
+  std::remove((opposites_path + ".sorted").c_str());
+  return true;
+}
+
+// Chunked mesh file written by BuildStreamedMesh. The file is mapped, so a
+// chunk is read from disk only when it is loaded
+class StreamedMesh {
+ public:
+  StreamedMesh(const std::string& path) : file(path) {
+    if (!file.IsOpen() || file.Size() < sizeof(StreamedMeshHeader)) return;
+    std::memcpy(&header, file.Data(), sizeof(header));
+    valid = std::memcmp(header.magic, "HESTREAM", 8) == 0 && header.version == kStreamedMeshVersion &&
+            header.chunk_triangles != 0 &&
+            header.triangles_offset + header.triangle_count * sizeof(StreamedTriangle) <= header.opposites_offset &&
+            header.opposites_offset + header.triangle_count * 3 * sizeof(std::uint64_t) == file.Size();
+  }
+  bool IsValid() const { return valid; }
+  std::uint64_t TriangleCount() const { return header.triangle_count; }
+  std::uint64_t NonManifoldEdges() const { return header.non_manifold_edges; }
+  std::size_t ChunkCount() const {
+    if (!valid) return 0;
+    return static_cast<std::size_t>((header.triangle_count + header.chunk_triangles - 1) / header.chunk_triangles);
+  }
+  // Builds the chunk in the empty mesh. The half-edges paired with a triangle
+  // of another chunk are left without opposite (the seam between the chunks),
+  // the return value is their number. If seam_positions is given it receives
+  // the two end points of every seam half-edge. If the file isn't valid or
+  // the chunk doesn't exist the mesh is left empty and 0 is returned
+  std::size_t LoadChunk(std::size_t chunk, HalfEdgeMesh& mesh, std::vector<glm::vec3>* seam_positions = nullptr) const {
+    if (chunk >= ChunkCount()) return 0;
+    const StreamedTriangle* triangles = reinterpret_cast<const StreamedTriangle*>(file.Data() + header.triangles_offset);
+    const std::uint64_t* opposites = reinterpret_cast<const std::uint64_t*>(file.Data() + header.opposites_offset);
+    std::uint64_t first = chunk * header.chunk_triangles;
+    std::uint64_t last = std::min<std::uint64_t>(header.triangle_count, first + header.chunk_triangles);
+    std::size_t count = static_cast<std::size_t>(last - first);
+    mesh.vertices.reserve(count * 3);
+    mesh.edges.reserve(count * 3);
+    mesh.faces.reserve(count);
+    // same layout of HalfEdgeMesh::AddFace
+    for (std::uint64_t t = first; t < last; ++t) {
+      HalfEdgeFace* face = new HalfEdgeFace(nullptr);
+      HalfEdge* face_edges[3];
+      for (int k = 0; k < 3; ++k) {
+        HalfEdgeVertex* vertex = new HalfEdgeVertex(triangles[t].corners[k], glm::vec3(0.0f));
+        face_edges[k] = new HalfEdge(vertex);
+        face_edges[k]->f = face;
+        mesh.vertices.push_back(vertex);
+        mesh.edges.push_back(face_edges[k]);
+      }
+      for (int k = 0; k < 3; ++k) {
+        face_edges[k]->next_edge = face_edges[(k + 1) % 3];
+        face_edges[k]->v->edge = face_edges[(k + 1) % 3];
+      }
+      face->edge = face_edges[0];
+      mesh.faces.push_back(face);
+    }
+    std::size_t seam = 0;
+    for (std::size_t i = 0; i < count * 3; ++i) {
+      std::uint64_t opposite = opposites[first * 3 + i];
+      if (opposite == kNoOpposite) continue;
+      if (opposite < first * 3 || opposite >= last * 3) {
+        ++seam;
+        if (seam_positions != nullptr) {
+          seam_positions->push_back(mesh.edges[i]->v->position);
+          seam_positions->push_back(mesh.edges[i]->next_edge->next_edge->v->position);
+        }
+        continue;
+      }
+      mesh.edges[i]->opposite_edge = mesh.edges[static_cast<std::size_t>(opposite - first * 3)];
+    }
+    // the corners at the same position share the id
+    FlatHashMap<glm::vec3, int> ids;
+    ids.reserve(mesh.vertices.size());
+    for (auto v : mesh.vertices) {
+      auto it = ids.find(v->position);
+      if (it == ids.end()) {
+        it = ids.insert(std::make_pair(v->position, static_cast<int>(ids.size()))).first;
+      }
+      v->id = it->second;
+    }
+    mesh.vertex_count = ids.size();
+    mesh.ComputeFacePlanes();
+    return seam;
+  }
+
+ private:
+  MappedFile file;
+  StreamedMeshHeader header{};
+  bool valid{false};
+};
+}  // namespace my_structs
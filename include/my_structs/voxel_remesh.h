@@ -0,0 +1,269 @@
+#pragma once
+#include <my_structs/halfedgedata.h>
+#include <my_structs/parallel.h>
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace my_structs {
+// closed triangle mesh that replaces a model in the farthest LODs
+struct VoxelProxy {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec3> normals;
+  std::vector<std::uint32_t> indices;
+  std::size_t TriangleCount() const { return indices.size() / 3; }
+};
+
+namespace voxel_detail {
+// squared distance of p from the triangle abc (Ericson, Real-Time Collision Detection)
+inline float TriangleDistanceSquared(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+  glm::vec3 ab = b - a, ac = c - a, ap = p - a;
+  float d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+  glm::vec3 closest;
+  if (d1 <= 0.0f && d2 <= 0.0f) {
+    closest = a;
+  } else {
+    glm::vec3 bp = p - b;
+    float d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+    glm::vec3 cp = p - c;
+    float d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+    float vc = d1 * d4 - d3 * d2;
+    float vb = d5 * d2 - d1 * d6;
+    float va = d3 * d6 - d5 * d4;
+    if (d3 >= 0.0f && d4 <= d3) {
+      closest = b;
+    } else if (d6 >= 0.0f && d5 <= d6) {
+      closest = c;
+    } else if (vc <= 0.0f && d1 >= 0.0f && d3 <= 0.0f) {
+      closest = a + ab * (d1 / (d1 - d3));
+    } else if (vb <= 0.0f && d2 >= 0.0f && d6 <= 0.0f) {
+      closest = a + ac * (d2 / (d2 - d6));
+    } else if (va <= 0.0f && (d4 - d3) >= 0.0f && (d5 - d6) >= 0.0f) {
+      closest = b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+    } else {
+      float denom = 1.0f / (va + vb + vc);
+      closest = a + ab * (vb * denom) + ac * (vc * denom);
+    }
+  }
+  glm::vec3 d = p - closest;
+  return glm::dot(d, d);
+}
+}  // namespace voxel_detail
+
+// Builds a closed proxy of the mesh on a grid with resolution points along
+// the longest side of the bounding box (clamped to [8, 256]):
+// 1. the faces mark the grid points closer than half a cell (in parallel);
+// 2. the points reached from the border without crossing a marked point are
+//    outside, all the others are solid (the holes of the mesh are filled);
+// 3. the solid field is smoothed and its 0.5 level is extracted with surface
+//    nets (one vertex in every cell crossed by the surface, one quad for
+//    every crossed grid edge), so the result is always closed.
+// Only the first step reads the faces, the rest depends only on the
+// resolution: the proxy of a huge mesh costs about as much as a small one
+inline VoxelProxy VoxelRemesh(const HalfEdgeMesh& mesh, int resolution) {
+  VoxelProxy proxy;
+  if (mesh.faces.empty()) return proxy;
+  resolution = std::max(8, std::min(resolution, 256));
+  glm::vec3 min = mesh.faces[0]->edge->v->position;
+  glm::vec3 max = min;
+  for (auto f : mesh.faces) {
+    for (auto e : f->Edges()) {
+      min = glm::min(min, e->v->position);
+      max = glm::max(max, e->v->position);
+    }
+  }
+  glm::vec3 extent = max - min;
+  float h = std::max(extent.x, std::max(extent.y, extent.z)) / static_cast<float>(resolution);
+  if (!(h > 0.0f)) return proxy;
+  // two empty points on every side: one for the smoothing, one for the flood fill
+  const int pad = 2;
+  glm::vec3 origin = min - glm::vec3(pad * h);
+  int nx = static_cast<int>(std::ceil(extent.x / h)) + 1 + 2 * pad;
+  int ny = static_cast<int>(std::ceil(extent.y / h)) + 1 + 2 * pad;
+  int nz = static_cast<int>(std::ceil(extent.z / h)) + 1 + 2 * pad;
+  std::size_t count = static_cast<std::size_t>(nx) * ny * nz;
+  auto index = [nx, ny](int x, int y, int z) {
+    return (static_cast<std::size_t>(z) * ny + y) * nx + x;
+  };
+
+  // 1. surface points: any step between two neighbour points that crosses
+  // a face passes within half a cell of one of them
+  enum : std::uint8_t { kEmpty = 0, kSurface = 1, kOutside = 2 };
+  std::unique_ptr<std::atomic<std::uint8_t>[]> grid(new std::atomic<std::uint8_t>[count]);
+  for (std::size_t i = 0; i < count; ++i) {
+    grid[i].store(kEmpty, std::memory_order_relaxed);
+  }
+  float max_distance_squared = 0.25f * h * h * 1.0001f;
+  ParallelFor(0, mesh.faces.size(), [&](std::size_t i) {
+    const HalfEdgeFace* f = mesh.faces[i];
+    glm::vec3 a = f->edge->next_edge->next_edge->v->position;
+    glm::vec3 b = f->edge->v->position;
+    glm::vec3 c = f->edge->next_edge->v->position;
+    glm::ivec3 first = glm::ivec3(glm::floor((glm::min(a, glm::min(b, c)) - origin) / h - 0.5f));
+    glm::ivec3 last = glm::ivec3(glm::ceil((glm::max(a, glm::max(b, c)) - origin) / h + 0.5f));
+    first = glm::max(first, glm::ivec3(0));
+    last = glm::min(last, glm::ivec3(nx - 1, ny - 1, nz - 1));
+    for (int z = first.z; z <= last.z; ++z) {
+      for (int y = first.y; y <= last.y; ++y) {
+        for (int x = first.x; x <= last.x; ++x) {
+          glm::vec3 p = origin + glm::vec3(x, y, z) * h;
+          if (voxel_detail::TriangleDistanceSquared(p, a, b, c) <= max_distance_squared) {
+            grid[index(x, y, z)].store(kSurface, std::memory_order_relaxed);
+          }
+        }
+      }
+    }
+  }, 256);
+
+  // 2. flood fill of the outside from a corner (6-connected)
+  std::vector<std::size_t> stack;
+  stack.push_back(0);
+  grid[0].store(kOutside, std::memory_order_relaxed);
+  while (!stack.empty()) {
+    std::size_t i = stack.back();
+    stack.pop_back();
+    int x = static_cast<int>(i % nx);
+    int y = static_cast<int>((i / nx) % ny);
+    int z = static_cast<int>(i / (static_cast<std::size_t>(nx) * ny));
+    const int offsets[6][3] = {{-1, 0, 0}, {1, 0, 0}, {0, -1, 0}, {0, 1, 0}, {0, 0, -1}, {0, 0, 1}};
+    for (auto& o : offsets) {
+      int X = x + o[0], Y = y + o[1], Z = z + o[2];
+      if (X < 0 || Y < 0 || Z < 0 || X >= nx || Y >= ny || Z >= nz) continue;
+      std::size_t j = index(X, Y, Z);
+      if (grid[j].load(std::memory_order_relaxed) == kEmpty) {
+        grid[j].store(kOutside, std::memory_order_relaxed);
+        stack.push_back(j);
+      }
+    }
+  }
+  std::vector<float> field(count);
+  ParallelFor(0, count, [&](std::size_t i) {
+    field[i] = grid[i].load(std::memory_order_relaxed) == kOutside ? 0.0f : 1.0f;
+  });
+  grid.reset();
+
+  // 3a. [1 2 1] / 4 filter along the three axes, one slice per task
+  std::vector<float> smoothed(count);
+  const int steps[3] = {1, nx, nx * ny};
+  const int sizes[3] = {nx, ny, nz};
+  for (int axis = 0; axis < 3; ++axis) {
+    ParallelFor(0, nz, [&](std::size_t z) {
+      for (int y = 0; y < ny; ++y) {
+        for (int x = 0; x < nx; ++x) {
+          int coordinate = axis == 0 ? x : axis == 1 ? y : static_cast<int>(z);
+          std::size_t i = index(x, y, static_cast<int>(z));
+          float left = coordinate > 0 ? field[i - steps[axis]] : 0.0f;
+          float right = coordinate + 1 < sizes[axis] ? field[i + steps[axis]] : 0.0f;
+          smoothed[i] = 0.25f * left + 0.5f * field[i] + 0.25f * right;
+        }
+      }
+    }, 1);
+    field.swap(smoothed);
+  }
+  std::vector<float>().swap(smoothed);
+
+  // 3b. a vertex in every cell with corners on both sides of the level, at
+  // the mean of the crossings of its edges
+  const float iso = 0.5f;
+  const int corner_offsets[8][3] = {{0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {1, 1, 0},
+                                    {0, 0, 1}, {1, 0, 1}, {0, 1, 1}, {1, 1, 1}};
+  const int cell_edges[12][2] = {{0, 1}, {2, 3}, {4, 5}, {6, 7}, {0, 2}, {1, 3},
+                                 {4, 6}, {5, 7}, {0, 4}, {1, 5}, {2, 6}, {3, 7}};
+  std::vector<std::vector<std::pair<std::size_t, glm::vec3>>> slice_vertices(nz - 1);
+  ParallelFor(0, nz - 1, [&](std::size_t z) {
+    for (int y = 0; y + 1 < ny; ++y) {
+      for (int x = 0; x + 1 < nx; ++x) {
+        float values[8];
+        int inside = 0;
+        for (int k = 0; k < 8; ++k) {
+          values[k] = field[index(x + corner_offsets[k][0], y + corner_offsets[k][1], static_cast<int>(z) + corner_offsets[k][2])];
+          inside += values[k] > iso ? 1 : 0;
+        }
+        if (inside == 0 || inside == 8) continue;
+        glm::vec3 sum = glm::vec3(0.0f);
+        int crossings = 0;
+        for (auto& edge : cell_edges) {
+          float v0 = values[edge[0]], v1 = values[edge[1]];
+          if ((v0 > iso) == (v1 > iso)) continue;
+          float t = (iso - v0) / (v1 - v0);
+          glm::vec3 p0 = glm::vec3(corner_offsets[edge[0]][0], corner_offsets[edge[0]][1], corner_offsets[edge[0]][2]);
+          glm::vec3 p1 = glm::vec3(corner_offsets[edge[1]][0], corner_offsets[edge[1]][1], corner_offsets[edge[1]][2]);
+          sum += p0 + (p1 - p0) * t;
+          ++crossings;
+        }
+        glm::vec3 local = sum / static_cast<float>(crossings);
+        slice_vertices[z].push_back(std::make_pair(index(x, y, static_cast<int>(z)),
+                                                   origin + (glm::vec3(x, y, z) + local) * h));
+      }
+    }
+  }, 1);
+  std::vector<std::int32_t> cell_vertex(count, -1);
+  for (auto& vertices : slice_vertices) {
+    for (auto& item : vertices) {
+      cell_vertex[item.first] = static_cast<std::int32_t>(proxy.positions.size());
+      proxy.positions.push_back(item.second);
+    }
+    std::vector<std::pair<std::size_t, glm::vec3>>().swap(vertices);
+  }
+  // the normals follow the gradient of the field (it grows inside)
+  proxy.normals.resize(proxy.positions.size());
+  ParallelFor(0, proxy.positions.size(), [&](std::size_t i) {
+    glm::vec3 g = (proxy.positions[i] - origin) / h;
+    int x = std::max(1, std::min(static_cast<int>(g.x + 0.5f), nx - 2));
+    int y = std::max(1, std::min(static_cast<int>(g.y + 0.5f), ny - 2));
+    int z = std::max(1, std::min(static_cast<int>(g.z + 0.5f), nz - 2));
+    glm::vec3 gradient = glm::vec3(field[index(x + 1, y, z)] - field[index(x - 1, y, z)],
+                                   field[index(x, y + 1, z)] - field[index(x, y - 1, z)],
+                                   field[index(x, y, z + 1)] - field[index(x, y, z - 1)]);
+    float length = glm::length(gradient);
+    proxy.normals[i] = length > 0.0f ? -gradient / length : glm::vec3(0.0f);
+  });
+
+  // 3c. two triangles for every grid edge crossed by the level, between the
+  // four cells around it, facing the outside
+  std::vector<std::vector<std::uint32_t>> slice_indices(nz);
+  ParallelFor(1, nz - 1, [&](std::size_t z) {
+    for (int y = 1; y + 1 < ny; ++y) {
+      for (int x = 1; x + 1 < nx; ++x) {
+        int p[3] = {x, y, static_cast<int>(z)};
+        bool inside = field[index(x, y, p[2])] > iso;
+        for (int axis = 0; axis < 3; ++axis) {
+          int q[3] = {p[0], p[1], p[2]};
+          ++q[axis];
+          if (q[axis] >= sizes[axis] - 1) continue;
+          if ((field[index(q[0], q[1], q[2])] > iso) == inside) continue;
+          // cells around the edge, counterclockwise seen from +axis
+          int u = (axis + 1) % 3, v = (axis + 2) % 3;
+          const int around[4][2] = {{-1, -1}, {0, -1}, {0, 0}, {-1, 0}};
+          std::int32_t quad[4];
+          for (int k = 0; k < 4; ++k) {
+            int c[3] = {p[0], p[1], p[2]};
+            c[u] += around[k][0];
+            c[v] += around[k][1];
+            quad[k] = cell_vertex[index(c[0], c[1], c[2])];
+          }
+          if (quad[0] < 0 || quad[1] < 0 || quad[2] < 0 || quad[3] < 0) continue;
+          // the outside is towards +axis when the first point is inside
+          if (!inside) std::swap(quad[1], quad[3]);
+          std::vector<std::uint32_t>& out = slice_indices[z];
+          out.push_back(quad[0]);
+          out.push_back(quad[1]);
+          out.push_back(quad[2]);
+          out.push_back(quad[0]);
+          out.push_back(quad[2]);
+          out.push_back(quad[3]);
+        }
+      }
+    }
+  }, 1);
+  for (auto& indices : slice_indices) {
+    proxy.indices.insert(proxy.indices.end(), indices.begin(), indices.end());
+  }
+  return proxy;
+}
+}  // namespace my_structs
@@ -0,0 +1,99 @@
+#pragma once
+#include <utils/vertex.h>
+#include <my_structs/parallel.h>
+#include <my_structs/flat_hash_map.h>
+
+#include <glm/glm.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace my_structs {
+// Welds the vertices closer than tolerance: every vertex takes the position of
+// the vertex with the smallest index found within the tolerance, so that the
+// half-edge mesh (which identifies the vertices by position) connects the
+// triangles of scans with a small jitter in the coordinates.
+// The vertices are put in a uniform grid (cells of size >= tolerance) stored
+// as a sorted array plus a hash map from the cell to its range, then every
+// vertex looks at the 27 cells around it in parallel.
+// It returns the number of vertices moved
+inline std::size_t WeldVertices(std::vector<Vertex>& vertices, float tolerance) {
+  if (vertices.empty() || tolerance <= 0.0f) return 0;
+  glm::vec3 min = vertices[0].Position;
+  glm::vec3 max = min;
+  for (auto& vertex : vertices) {
+    min = glm::min(min, vertex.Position);
+    max = glm::max(max, vertex.Position);
+  }
+  // 21 bits for each coordinate of the cell, if the tolerance is too small for
+  // the size of the model the cells become bigger (the result doesn't change)
+  const float max_cells = 2097151.0f;
+  glm::vec3 extent = max - min;
+  float cell_size = std::max(tolerance, std::max(extent.x, std::max(extent.y, extent.z)) / (max_cells - 2.0f));
+  auto cell_of = [&](glm::vec3 position) {
+    glm::vec3 cell = glm::floor((position - min) / cell_size);
+    return glm::clamp(glm::ivec3(cell), glm::ivec3(0), glm::ivec3(static_cast<int>(max_cells)));
+  };
+  auto key_of = [](glm::ivec3 cell) {
+    return static_cast<std::uint64_t>(cell.x) | (static_cast<std::uint64_t>(cell.y) << 21) |
+           (static_cast<std::uint64_t>(cell.z) << 42);
+  };
+
+  // vertices sorted by cell
+  std::vector<std::pair<std::uint64_t, std::uint32_t>> sorted(vertices.size());
+  ParallelFor(0, vertices.size(), [&](std::size_t i) {
+    sorted[i] = std::make_pair(key_of(cell_of(vertices[i].Position)), static_cast<std::uint32_t>(i));
+  });
+  std::sort(sorted.begin(), sorted.end());
+  // first element of every cell in the sorted array
+  FlatHashMap<std::uint64_t, std::uint32_t> cells;
+  cells.reserve(sorted.size());
+  for (std::size_t i = 0; i < sorted.size(); ++i) {
+    if (i == 0 || sorted[i].first != sorted[i - 1].first) {
+      cells[sorted[i].first] = static_cast<std::uint32_t>(i);
+    }
+  }
+
+  // every vertex links to the smallest index within the tolerance
+  const float tolerance2 = tolerance * tolerance;
+  std::vector<std::uint32_t> link(vertices.size());
+  ParallelFor(0, vertices.size(), [&](std::size_t i) {
+    glm::vec3 position = vertices[i].Position;
+    glm::ivec3 cell = cell_of(position);
+    std::uint32_t smallest = static_cast<std::uint32_t>(i);
+    for (int dz = -1; dz <= 1; ++dz) {
+      for (int dy = -1; dy <= 1; ++dy) {
+        for (int dx = -1; dx <= 1; ++dx) {
+          glm::ivec3 neighbour = cell + glm::ivec3(dx, dy, dz);
+          if (neighbour.x < 0 || neighbour.y < 0 || neighbour.z < 0) continue;
+          std::uint64_t key = key_of(neighbour);
+          auto it = cells.find(key);
+          if (it == cells.end()) continue;
+          for (std::size_t j = it->second; j < sorted.size() && sorted[j].first == key; ++j) {
+            std::uint32_t other = sorted[j].second;
+            if (other >= smallest) continue;
+            glm::vec3 d = vertices[other].Position - position;
+            if (glm::dot(d, d) <= tolerance2) {
+              smallest = other;
+            }
+          }
+        }
+      }
+    }
+    link[i] = smallest;
+  });
+
+  // the links always go to a smaller index, so the roots are found in order
+  std::size_t welded = 0;
+  for (std::size_t i = 0; i < vertices.size(); ++i) {
+    link[i] = link[i] == i ? link[i] : link[link[i]];
+    if (link[i] != i) {
+      vertices[i].Position = vertices[link[i]].Position;
+      ++welded;
+    }
+  }
+  return welded;
+}
+}  // namespace my_structs
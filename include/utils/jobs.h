@@ -0,0 +1,406 @@
+/*
+JobSystem class
+- a small work-stealing job system shared by the whole application: the render loop, the importers and the simplification submit their work to the same threads, instead of creating threads for every parallel loop
+
+Every worker thread has its own deque of jobs: a worker takes the newest job of its deque (the last job it submitted, whose data is probably still in cache), and when its deque is empty it "steals" the oldest job of another worker. The jobs submitted by a thread outside the pool are dealt round robin to the deques.
+A thread waiting for some jobs (TaskGroup::Wait, ParallelFor, TaskGraph::Run, WaitIdle) doesn't sleep while there are jobs in the deques: it runs them too. This means that a job can wait for other jobs (e.g. a ParallelFor inside a job) without blocking a worker.
+
+The class provides:
+- Submit: a job with no result
+- TaskGroup: a set of jobs that can be waited together
+- ParallelFor: a loop on a range of indices, split in chunks that can be stolen by the idle workers
+- TaskGraph: jobs with dependencies, a job starts when all the jobs before it are finished
+- RunOnMainThread / RunMainThreadTasks: continuations that must be executed on the main thread (e.g., the creation of the OpenGL buffers, because the OpenGL context belongs to the main thread). The render loop calls RunMainThreadTasks once per frame
+
+N.B.) the jobs must not throw exceptions
+
+author: Andrea Pulita
+
+Real-Time Graphics Programming - a.a. 2022/2023
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+///////////////////  JobSystem class ///////////////////////
+class JobSystem
+{
+public:
+    typedef std::function<void()> Task;
+
+    // threads is the number of workers. kHardwareThreads creates a worker for every hardware thread except one, because the thread that waits for the jobs works too. With 0 workers there are no threads: every job is executed by Submit on the calling thread
+    static const std::size_t kHardwareThreads = static_cast<std::size_t>(-1);
+
+    explicit JobSystem(std::size_t threads = kHardwareThreads)
+    {
+        if (threads == kHardwareThreads)
+            threads = std::max<std::size_t>(2, std::thread::hardware_concurrency()) - 1;
+        for (std::size_t i = 0; i < threads; ++i)
+            queues.emplace_back(new Queue());
+        workers.reserve(threads);
+        for (std::size_t i = 0; i < threads; ++i)
+            workers.emplace_back([this, i]() { WorkerLoop(i); });
+    }
+
+    // JobSystem is not copyable: the workers keep a pointer to it
+    JobSystem(const JobSystem&) = delete;
+    JobSystem& operator=(const JobSystem&) = delete;
+
+    // the destructor waits for all the jobs, and then it stops the workers
+    ~JobSystem()
+    {
+        WaitIdle();
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers)
+            worker.join();
+    }
+
+    // the job system shared by the application. It is created by the first call, and threads is considered only in that call
+    static JobSystem& Shared(std::size_t threads = kHardwareThreads)
+    {
+        static JobSystem shared(threads);
+        return shared;
+    }
+
+    std::size_t ThreadCount() const
+    {
+        return workers.size();
+    }
+
+    void Submit(Task task)
+    {
+        if (workers.empty())
+        {
+            task();
+            return;
+        }
+        // a worker puts the job in its own deque, the other threads in the deques of the workers in turn
+        std::size_t index = CurrentWorker().jobs == this ? CurrentWorker().index : next_queue.fetch_add(1) % queues.size();
+        pending.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+        {
+            // queued is changed under the lock, so a thread going to sleep can't miss the new job
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            ++queued;
+            if (helpers > 0)
+                done.notify_all();
+        }
+        wake.notify_one();
+    }
+
+    // it runs jobs on the calling thread until all the submitted jobs are finished. It can't be called by a job
+    void WaitIdle()
+    {
+        HelpUntil([this]() { return pending.load() == 0; });
+    }
+
+    // it runs jobs on the calling thread until finished() is true. finished must become true only after a call to NotifyProgress
+    template <typename Predicate>
+    void HelpUntil(Predicate finished)
+    {
+        Task task;
+        std::size_t index = CurrentWorker().jobs == this ? CurrentWorker().index : queues.size();
+        while (!finished())
+        {
+            if (TryTake(index, task))
+            {
+                Run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            ++helpers;
+            done.wait(lock, [&]() { return finished() || queued > 0; });
+            --helpers;
+        }
+    }
+
+    // it wakes up the threads in HelpUntil, to check again their condition
+    void NotifyProgress()
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        done.notify_all();
+    }
+
+    // fn(i) is called for every index in [begin, end). The range is split in chunks of at least min_chunk indices (a few chunks for every thread, so the idle workers can steal them). The calling thread works on the first chunk, and small ranges are executed only by the calling thread
+    template <typename Fn>
+    void ParallelFor(std::size_t begin, std::size_t end, Fn fn, std::size_t min_chunk = 1024);
+
+    // the task is executed on the main thread during the next call to RunMainThreadTasks
+    void RunOnMainThread(Task task)
+    {
+        std::lock_guard<std::mutex> lock(main_mutex);
+        main_tasks.push_back(std::move(task));
+    }
+
+    // work is executed by the workers, and then continuation on the main thread (e.g., work prepares the vertices of a mesh and continuation creates its OpenGL buffers)
+    void SubmitWithContinuation(Task work, Task continuation)
+    {
+        Submit([this, work, continuation]()
+        {
+            work();
+            RunOnMainThread(continuation);
+        });
+    }
+
+    // it must be called by the main thread (in the render loop): it executes the tasks added by RunOnMainThread, and it returns how many tasks were executed
+    std::size_t RunMainThreadTasks()
+    {
+        std::vector<Task> tasks;
+        {
+            std::lock_guard<std::mutex> lock(main_mutex);
+            tasks.swap(main_tasks);
+        }
+        for (auto& task : tasks)
+            task();
+        return tasks.size();
+    }
+
+private:
+    // deque of the jobs of a worker
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+    // the job system and the deque of the worker running on this thread
+    struct WorkerSlot
+    {
+        JobSystem* jobs = nullptr;
+        std::size_t index = 0;
+    };
+    static WorkerSlot& CurrentWorker()
+    {
+        thread_local WorkerSlot slot;
+        return slot;
+    }
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+    // sleeping workers wait on wake, the threads in HelpUntil on done
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    // jobs in the deques and threads in HelpUntil (both protected by sleep_mutex)
+    std::size_t queued = 0;
+    std::size_t helpers = 0;
+    // jobs submitted and not finished yet
+    std::atomic<std::size_t> pending{0};
+    std::atomic<std::size_t> next_queue{0};
+    bool stopping = false;
+    // tasks for the main thread
+    std::mutex main_mutex;
+    std::vector<Task> main_tasks;
+
+    void WorkerLoop(std::size_t index)
+    {
+        CurrentWorker().jobs = this;
+        CurrentWorker().index = index;
+        Task task;
+        for (;;)
+        {
+            if (TryTake(index, task))
+            {
+                Run(task);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            wake.wait(lock, [this]() { return stopping || queued > 0; });
+            if (stopping && queued == 0)
+                return;
+        }
+    }
+
+    // the newest job of the deque of index (if the thread is a worker), otherwise the oldest job of the first other deque that has one
+    bool TryTake(std::size_t index, Task& task)
+    {
+        if (index < queues.size() && Pop(*queues[index], task, true))
+            return true;
+        std::size_t start = index < queues.size() ? index + 1 : 0;
+        for (std::size_t k = 0; k < queues.size(); ++k)
+        {
+            std::size_t victim = (start + k) % queues.size();
+            if (victim != index && Pop(*queues[victim], task, false))
+                return true;
+        }
+        return false;
+    }
+
+    bool Pop(Queue& queue, Task& task, bool newest)
+    {
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.tasks.empty())
+                return false;
+            if (newest)
+            {
+                task = std::move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = std::move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+        }
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        --queued;
+        return true;
+    }
+
+    void Run(Task& task)
+    {
+        task();
+        task = nullptr;
+        if (pending.fetch_sub(1) == 1)
+            NotifyProgress();
+    }
+};
+
+///////////////////  TaskGroup class ///////////////////////
+// jobs that are waited together. Wait can be called also by a job (e.g., a job that splits its work in smaller jobs)
+class TaskGroup
+{
+public:
+    explicit TaskGroup(JobSystem& jobs = JobSystem::Shared()) : jobs(jobs) {}
+
+    // the group must be waited before its destruction
+    ~TaskGroup()
+    {
+        Wait();
+    }
+
+    void Run(JobSystem::Task task)
+    {
+        count.fetch_add(1);
+        JobSystem* system = &jobs;
+        jobs.Submit([this, system, task]()
+        {
+            task();
+            // the group can be destroyed as soon as count is zero, so only system is used after that
+            if (count.fetch_sub(1) == 1)
+                system->NotifyProgress();
+        });
+    }
+
+    void Wait()
+    {
+        jobs.HelpUntil([this]() { return count.load() == 0; });
+    }
+
+    JobSystem& System()
+    {
+        return jobs;
+    }
+
+private:
+    JobSystem& jobs;
+    std::atomic<std::size_t> count{0};
+};
+
+template <typename Fn>
+void JobSystem::ParallelFor(std::size_t begin, std::size_t end, Fn fn, std::size_t min_chunk)
+{
+    if (end <= begin)
+        return;
+    std::size_t count = end - begin;
+    min_chunk = std::max<std::size_t>(1, min_chunk);
+    // 4 chunks for every thread (the workers and the calling thread)
+    std::size_t chunks = std::min((count + min_chunk - 1) / min_chunk, 4 * (ThreadCount() + 1));
+    if (chunks <= 1 || ThreadCount() == 0)
+    {
+        for (std::size_t i = begin; i < end; ++i)
+            fn(i);
+        return;
+    }
+    std::size_t chunk = (count + chunks - 1) / chunks;
+    TaskGroup group(*this);
+    for (std::size_t first = begin + chunk; first < end; first += chunk)
+    {
+        std::size_t last = std::min(end, first + chunk);
+        group.Run([first, last, &fn]()
+        {
+            for (std::size_t i = first; i < last; ++i)
+                fn(i);
+        });
+    }
+    for (std::size_t i = begin; i < begin + chunk; ++i)
+        fn(i);
+    group.Wait();
+}
+
+///////////////////  TaskGraph class ///////////////////////
+// jobs with dependencies: a job is submitted when all the jobs that precede it are finished. The graph must be acyclic, and it can be executed more than once
+class TaskGraph
+{
+public:
+    typedef std::size_t Node;
+
+    Node Add(JobSystem::Task task)
+    {
+        nodes.emplace_back(new NodeData());
+        nodes.back()->task = std::move(task);
+        return nodes.size() - 1;
+    }
+
+    // after starts only when before is finished
+    void Precede(Node before, Node after)
+    {
+        nodes[before]->successors.push_back(after);
+        ++nodes[after]->dependencies;
+    }
+
+    // it executes all the jobs of the graph, and it returns when they are finished
+    void Run(JobSystem& jobs = JobSystem::Shared())
+    {
+        for (auto& node : nodes)
+            node->remaining.store(node->dependencies);
+        TaskGroup group(jobs);
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+            if (nodes[i]->dependencies == 0)
+                Start(group, i);
+        group.Wait();
+    }
+
+private:
+    struct NodeData
+    {
+        JobSystem::Task task;
+        std::vector<Node> successors;
+        int dependencies = 0;
+        std::atomic<int> remaining{0};
+    };
+    std::vector<std::unique_ptr<NodeData>> nodes;
+
+    void Start(TaskGroup& group, Node node)
+    {
+        group.Run([this, &group, node]()
+        {
+            nodes[node]->task();
+            // the last finished job before a successor starts it
+            for (auto successor : nodes[node]->successors)
+                if (nodes[successor]->remaining.fetch_sub(1) == 1)
+                    Start(group, successor);
+        });
+    }
+};
@@ -32,18 +32,7 @@ using namespace std;
 #include <vector>
 
 // data structure for vertices
-struct Vertex {
-    // vertex coordinates
-    glm::vec3 Position;
-    // Normal
-    glm::vec3 Normal;
-    // Texture coordinates
-    glm::vec2 TexCoords;
-    // Tangent
-    glm::vec3 Tangent;
-    // Bitangent
-    glm::vec3 Bitangent;
-};
+#include <utils/vertex.h>
 
 /////////////////// MESH class ///////////////////////
 class Mesh {
@@ -137,6 +126,15 @@ public:
         glBindVertexArray(0);
     }
 
+    // the vertices in the range [first, first + count) are copied again from the vertices vector to the VBO
+    // (used to update only the part of the mesh that has been modified, without creating new buffers)
+    void UpdateVertices(GLuint first, GLuint count)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, this->VBO);
+        glBufferSubData(GL_ARRAY_BUFFER, first * sizeof(Vertex), count * sizeof(Vertex), &this->vertices[first]);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
 private:
 
     // VBO and EBO
@@ -0,0 +1,30 @@
+/*
+Vertex data structure
+- the attributes of a vertex of a Mesh, in the order of the vertex buffer (see mesh.h)
+
+It is in a separate header without OpenGL, so the code that only processes the geometry (e.g., the half-edge mesh and the simplification) can use it in programs without an OpenGL context
+
+author: Davide Gadia, Michael Marchesan
+
+Real-Time Graphics Programming - a.a. 2022/2023
+Master degree in Computer Science
+Universita' degli Studi di Milano
+*/
+
+#pragma once
+
+#include <glm/glm.hpp>
+
+// data structure for vertices
+struct Vertex {
+    // vertex coordinates
+    glm::vec3 Position;
+    // Normal
+    glm::vec3 Normal;
+    // Texture coordinates
+    glm::vec2 TexCoords;
+    // Tangent
+    glm::vec3 Tangent;
+    // Bitangent
+    glm::vec3 Bitangent;
+};
@@ -25,6 +25,7 @@
 #include <utils/shader.h>
 #include <utils/model.h>
 #include <utils/camera.h>
+#include <utils/jobs.h>
 
 // we load the GLM classes used in the application
 #include <glm/glm.hpp>
@@ -35,6 +36,10 @@
 // classes developed for this project
 #include <my_structs/halfedgedata.h>
 #include <my_structs/simplification.h>
+#include <my_structs/snapshot.h>
+#include <my_structs/result_cache.h>
+#include <my_structs/model_simplifier.h>
+#include <my_structs/epoch.h>
 #include <my_structs/line.h>
 
 // we include the library for images loading
@@ -51,6 +56,8 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods);
 // functions for the menu application
 void show_menu();
 void createModel(int model);
+// update the mesh on the GPU after the simplification (or create it again if the partial update is not possible)
+void UpdateCurrentMesh();
 // the name of the subroutines are searched in the shaders, and placed in the shaders vector (to allow shaders swapping)
 void SetupShader(int shader_program);
 // print on console the name of current shader subroutine
@@ -102,6 +109,9 @@ bool simplify = false;
 // boolean to ignore the error
 bool ignore_error = false;
 
+// vertices closer than this distance are welded when the half-edge mesh is created
+float weld_tolerance = 0.0001f;
+
 // index of the selected model
 int selected_model = 0;
 int current_model = 0;
@@ -137,9 +147,17 @@ GLuint textureCube;
 
 // structures for the models and the simplification
 Model currentModel;
-Mesh* currentMesh;
-my_structs::HalfEdgeMesh* currentHEMesh;
-my_structs::MeshSimplification_QEM* simply;
+Mesh* currentMesh = nullptr;
+my_structs::HalfEdgeMesh* currentHEMesh = nullptr;
+my_structs::MeshSimplification_QEM* simply = nullptr;
+// models with more than one mesh are simplified part by part with a shared budget of faces
+my_structs::ModelSimplifier* modelSimplifier = nullptr;
+// the current half-edge mesh is published after each batch of collapses, the readers (e.g. the statistics) use the snapshots
+my_structs::MeshSnapshotPublisher meshSnapshots;
+Model simplifiedModel;
+bool draw_simplified_model = false;
+// path of the current model, the simplified meshes are cached next to it
+string currentModelPath;
 
 // --------------------MAIN APP---------------------
 int main()
@@ -213,12 +231,9 @@ int main()
 
     Model cubeModel("../resources/models/cube.obj"); // used for the environment map
 
-    // we load the current model (code of Model class is in include/utils/model.h)
+    // we load the current model and its half-edge data structure for the simplification algorithm
     createModel(selected_model);
-    // we create the half-edge data structure for the simplification algorithm
-    currentHEMesh = new my_structs::HalfEdgeMesh(currentModel.meshes[0]);
-    simply = new my_structs::MeshSimplification_QEM(*currentHEMesh);
-    currentMesh = currentHEMesh->ConvertToMesh(smooth_model);
+    UpdateCurrentMesh();
 
     // Projection matrix: FOV angle, aspect ratio, near and far planes
     glm::mat4 projection = glm::perspective(45.0f, (float)screenWidth / (float)screenHeight, 0.1f, 10000.0f);
@@ -252,11 +267,7 @@ int main()
             animated_simplification_ongoing = false;
             current_model = selected_model;
             createModel(selected_model);
-            delete(currentHEMesh);
-            delete(simply);
-            currentHEMesh = new my_structs::HalfEdgeMesh(currentModel.meshes[0]);
-            simply = new my_structs::MeshSimplification_QEM(*currentHEMesh);
-            currentMesh = currentHEMesh->ConvertToMesh(smooth_model);
+            UpdateCurrentMesh();
         }
         // we execute the simplification algorithm for just one edge to make the animation or we execute it without 
         if(animated_simplification_ongoing) {
@@ -265,8 +276,9 @@ int main()
             if(ignore_error) {
                 errorToUse = 100.0f;
             }
+            draw_simplified_model = false;
             bool finish = simply->SimplifyMesh(1, errorToUse);
-            currentMesh = currentHEMesh->ConvertToMesh(smooth_model);
+            UpdateCurrentMesh();
             if(animated_simplification_edges == 0 || !finish) {
                 animated_simplification_ongoing = false;
             }
@@ -277,23 +289,65 @@ int main()
                 if(ignore_error) {
                     errorToUse = 100.0f;
                 }
-                simply->SimplifyMesh(edgesToCollapse, errorToUse);
-                currentMesh = currentHEMesh->ConvertToMesh(smooth_model);
+                if(modelSimplifier != nullptr) {
+                    // all the meshes of the model are simplified, the faces to remove are shared by error
+                    size_t faces = modelSimplifier->FaceCount();
+                    modelSimplifier->Simplify(faces - faces * slider_i / 100, errorToUse);
+                    simplifiedModel = modelSimplifier->BuildModel(smooth_model);
+                    draw_simplified_model = true;
+                } else {
+                    // the same simplification of the same mesh is loaded from the cache
+                    my_structs::SimplificationCache cache(currentModelPath);
+                    my_structs::SimplificationKey key;
+                    key.content = my_structs::HashMeshContent(*currentHEMesh, simply->q_matrices);
+                    key.engine = "qem";
+                    key.target = edgesToCollapse;
+                    key.max_error = errorToUse;
+                    my_structs::HalfEdgeMesh* cachedMesh = new my_structs::HalfEdgeMesh();
+                    my_structs::FlatHashMap<glm::vec3, glm::mat4> quadrics;
+                    if (cache.Load(key, *cachedMesh, quadrics)) {
+                        delete(simply);
+                        delete(currentHEMesh);
+                        delete(currentMesh);
+                        currentMesh = nullptr;
+                        currentHEMesh = cachedMesh;
+                        simply = new my_structs::MeshSimplification_QEM(*currentHEMesh, std::move(quadrics));
+                    } else {
+                        delete(cachedMesh);
+                        // we start from the same state of a hit (the simplifier built again from the mesh and the quadrics),
+                        // so the stored result depends only on the key and not on the collapses done before
+                        my_structs::FlatHashMap<glm::vec3, glm::mat4> state = simply->q_matrices;
+                        delete(simply);
+                        simply = new my_structs::MeshSimplification_QEM(*currentHEMesh, std::move(state));
+                        simply->SimplifyMesh(edgesToCollapse, errorToUse);
+                        // after many collapses the elements are scattered, we sort them again
+                        simply->ReorderMesh();
+                        cache.Store(key, *currentHEMesh, &simply->q_matrices);
+                    }
+                    UpdateCurrentMesh();
+                }
                 simplify = false;
             }
             // we just collapse one edge if not in the animation
             if(collapseedge) {
+                draw_simplified_model = false;
                 simply->SimplifyMesh(1, 100);
-                currentMesh = currentHEMesh->ConvertToMesh(smooth_model);
+                UpdateCurrentMesh();
                 collapseedge = false;
             }
         }
         // we smooth the model if the user wants
         if(current_smooth_model != smooth_model) {
             current_smooth_model = smooth_model;
-            currentMesh = currentHEMesh->ConvertToMesh(smooth_model);
+            UpdateCurrentMesh();
+            if(draw_simplified_model) {
+                simplifiedModel = modelSimplifier->BuildModel(smooth_model);
+            }
         }
 
+        // we run the continuations of the jobs that need the OpenGL context (see utils/jobs.h)
+        JobSystem::Shared().RunMainThreadTasks();
+
         // Check is an I/O event is happening
         glfwPollEvents();
         apply_camera_movements();
@@ -369,7 +423,11 @@ int main()
         glUniformMatrix3fv(glGetUniformLocation(illumination_shader.Program, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(currentNormalMatrix));
         glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "projectionMatrix"), 1, GL_FALSE, glm::value_ptr(projection));
         glUniformMatrix4fv(glGetUniformLocation(illumination_shader.Program, "viewMatrix"), 1, GL_FALSE, glm::value_ptr(view));
-        currentMesh->Draw();
+        if(draw_simplified_model) {
+            simplifiedModel.Draw();
+        } else {
+            currentMesh->Draw();
+        }
         // we draw the edge to collapse
         line.setMVP(projection * view * currentModelMatrix);
         line.setPoints(simply->next_edge_to_collapse.first, simply->next_edge_to_collapse.second);
@@ -621,7 +679,11 @@ void show_menu() {
                     }
                 }
             }
-            ImGui::Text("Number of faces: %d", currentHEMesh->faces.size());
+            // the statistics pin the last published snapshot, as a thread that doesn't simplify would
+            {
+                my_structs::MeshSnapshotPublisher::ReadGuard snapshot = meshSnapshots.Read();
+                ImGui::Text("Number of faces: %d", snapshot.get() != nullptr ? (int)snapshot->FaceCount() : 0);
+            }
             ImGui::Text("Number of edges: %d", currentHEMesh->edges.size());
 
             ImGui::EndTabItem();
@@ -648,19 +710,60 @@ void show_menu() {
     ImGui::End();
 }
 
-// function to create the model based on the selected model
+// the faces changed by the collapses are patched in the current GPU buffers,
+// the mesh is created again only if the half-edge mesh can't patch it (smooth normals, new model, too many removed faces).
+// The changed faces are also published in a new snapshot for the readers
+void UpdateCurrentMesh() {
+    if (currentMesh == nullptr || !currentHEMesh->UpdateMesh(*currentMesh, smooth_model)) {
+        delete currentMesh;
+        currentMesh = currentHEMesh->ConvertToMesh(smooth_model);
+    }
+    meshSnapshots.Publish(*currentHEMesh);
+}
+
+// function to create the model based on the selected model:
+// if a snapshot of the half-edge mesh is saved next to the model we map it (no import, no pairing of the edges),
+// otherwise we import the model, we build the half-edge mesh and we save the snapshot for the next time
 void createModel(int model) {
+    string path;
     switch (model) {
         case 0:
-            currentModel = Model("../resources/models/bunny.obj");
+            path = "../resources/models/bunny.obj";
             break;
         case 1:
-            currentModel = Model("../resources/models/horse.obj");
+            path = "../resources/models/horse.obj";
             break;
         case 2:
-            currentModel = Model("../resources/models/dragon.obj");
+            path = "../resources/models/dragon.obj";
             break;
     }
+    currentModelPath = path;
+    delete(simply);
+    delete(currentHEMesh);
+    delete(modelSimplifier);
+    modelSimplifier = nullptr;
+    draw_simplified_model = false;
+    currentHEMesh = new my_structs::HalfEdgeMesh();
+    my_structs::FlatHashMap<glm::vec3, glm::mat4> quadrics;
+    // the snapshot is used only if the OBJ and the import parameters are the same of when it was saved
+    my_structs::SnapshotSource source = my_structs::MakeSnapshotSource(path, weld_tolerance, true);
+    if (my_structs::LoadSnapshot(path + ".hem", *currentHEMesh, quadrics, &source)) {
+        simply = new my_structs::MeshSimplification_QEM(*currentHEMesh, std::move(quadrics));
+        return;
+    }
+    delete(currentHEMesh);
+    // code of Model class is in include/utils/model.h
+    currentModel = Model(path);
+    currentHEMesh = new my_structs::HalfEdgeMesh(currentModel.meshes[0], weld_tolerance);
+    // we sort the elements along a space-filling curve to have a better cache locality
+    currentHEMesh->ReorderByMortonCurve();
+    simply = new my_structs::MeshSimplification_QEM(*currentHEMesh);
+    // the snapshot has just one mesh, the models with more meshes are imported every time
+    if (currentModel.meshes.size() > 1) {
+        modelSimplifier = new my_structs::ModelSimplifier(currentModel, weld_tolerance);
+    } else {
+        my_structs::SaveSnapshot(path + ".hem", *currentHEMesh, &simply->q_matrices, source);
+    }
 }
 
 // load one side of the cubemap, passing the name of the file and the side of the corresponding OpenGL cubemap
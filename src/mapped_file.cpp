@@ -0,0 +1,39 @@
+// Created by Andrea Pulita
+
+// Win32 implementation of MappedFile (include/my_structs/mapped_file.h), it
+// is in its own file so <windows.h> is not included by app.cpp
+
+#ifdef _WIN32
+
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+
+#include <my_structs/mapped_file.h>
+
+namespace my_structs {
+MappedFile::MappedFile(const std::string& path) {
+  HANDLE handle = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) return;
+  file = handle;
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(handle, &file_size) || file_size.QuadPart == 0) return;
+  mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  if (mapping == nullptr) return;
+  data = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+  if (data != nullptr) size = static_cast<std::size_t>(file_size.QuadPart);
+}
+
+MappedFile::~MappedFile() {
+  if (data != nullptr) UnmapViewOfFile(data);
+  if (mapping != nullptr) CloseHandle(mapping);
+  if (file != nullptr) CloseHandle(file);
+}
+}  // namespace my_structs
+
+#endif
@@ -0,0 +1,105 @@
+// Created by Andrea Pulita
+
+// Batch simplification of many meshes without the application window:
+//   batch_simplify [--ratio r] [--max-error e] [--threads n] [--out dir] [mesh.obj | directory]...
+// every OBJ given (or found in the given directories) is simplified to the
+// ratio r of its faces on the job system and written in dir as
+// <name>_simplified.obj. Without inputs the bunny, the horse and the dragon
+// of the application are simplified. --threads counts also the main thread
+// (1 runs everything on it), by default all the hardware threads are used
+
+// --------------------INLCUDE SECTION---------------------
+
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// classes developed for this project
+#include <my_structs/halfedgedata.h>
+#include <my_structs/obj_io.h>
+#include <my_structs/batch_simplifier.h>
+#include <utils/jobs.h>
+
+// ---------------------FUNCTIONS SECTION---------------------
+
+bool LoadObjMesh(const std::string& path, my_structs::BatchMesh& mesh)
+{
+    mesh.name = std::filesystem::path(path).stem().string();
+    return my_structs::ReadObj(path, mesh.vertices, mesh.indices);
+}
+
+// --------------------MAIN SECTION---------------------
+
+int main(int argc, char* argv[])
+{
+    my_structs::BatchOptions options;
+    std::size_t threads = 0;
+    std::string out_dir = ".";
+    std::vector<std::string> paths;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--ratio" && i + 1 < argc)
+            options.target_ratio = std::strtof(argv[++i], nullptr);
+        else if (arg == "--max-error" && i + 1 < argc)
+            options.max_error = std::strtof(argv[++i], nullptr);
+        else if (arg == "--threads" && i + 1 < argc)
+            threads = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--out" && i + 1 < argc)
+            out_dir = argv[++i];
+        else if (std::filesystem::is_directory(arg))
+        {
+            // we take all the OBJ files of the directory
+            for (auto& entry : std::filesystem::directory_iterator(arg))
+                if (entry.path().extension() == ".obj")
+                    paths.push_back(entry.path().string());
+        }
+        else
+            paths.push_back(arg);
+    }
+    if (paths.empty())
+    {
+        paths.push_back("../resources/models/bunny.obj");
+        paths.push_back("../resources/models/horse.obj");
+        paths.push_back("../resources/models/dragon.obj");
+    }
+
+    // we create the shared job system with the requested threads (the main thread works too), and we load the meshes with it, every file is independent
+    JobSystem& jobs = JobSystem::Shared(threads > 0 ? threads - 1 : JobSystem::kHardwareThreads);
+    std::vector<my_structs::BatchMesh> meshes(paths.size());
+    std::vector<char> loaded(paths.size(), 0);
+    jobs.ParallelFor(0, paths.size(), [&](std::size_t i) { loaded[i] = LoadObjMesh(paths[i], meshes[i]) ? 1 : 0; }, 1);
+    std::vector<my_structs::BatchMesh> inputs;
+    for (std::size_t i = 0; i < paths.size(); ++i)
+    {
+        if (loaded[i])
+            inputs.push_back(std::move(meshes[i]));
+        else
+            std::cout << "batch_simplify: can't read " << paths[i] << std::endl;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<my_structs::BatchResult> results = my_structs::SimplifyBatch(inputs, options, jobs);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::filesystem::create_directories(out_dir);
+    int failed = 0;
+    for (auto& result : results)
+    {
+        std::string path = (std::filesystem::path(out_dir) / (result.name + "_simplified.obj")).string();
+        bool saved = my_structs::WriteObj(path, result.vertices, result.indices);
+        failed += saved ? 0 : 1;
+        std::cout << result.name << ": " << result.faces_before << " -> " << result.faces_after << " faces in "
+                  << result.seconds << " s" << (result.reached_target ? "" : " (target not reached)")
+                  << (saved ? "" : " (write failed)") << std::endl;
+    }
+    std::cout << results.size() << " meshes simplified in " << seconds << " s with "
+              << jobs.ThreadCount() + 1 << " threads" << std::endl;
+    return (failed > 0 || inputs.size() < paths.size()) ? 1 : 0;
+}
@@ -0,0 +1,303 @@
+// Created by Andrea Pulita
+
+// Command-line simplifier, it doesn't need a window or OpenGL (e.g. for the
+// machines without a display):
+//   simplify input.obj output.obj [--engine qem | qem-double | qem-bucketed | voxel]
+//            [--faces n | --ratio r] [--max-error e] [--weld t] [--virtual-pairs d]
+//            [--resolution n] [--flat] [--no-quality] [--threads n]
+// the mesh is simplified to n faces (or to the ratio r of its faces, 0.5 by
+// default) and written in output.obj. The voxel engine doesn't collapse
+// edges: it replaces the mesh with the closed proxy of VoxelRemesh, built on
+// a grid with n points along the longest side (64 by default), so its faces
+// depend on the resolution and not on the target. --threads counts also the main thread
+// (1 runs everything on it), by default all the hardware threads are used.
+// The statistics (timings and quality) are printed on the standard output
+// as JSON, the messages of the simplification go on the standard error
+
+// --------------------INLCUDE SECTION---------------------
+
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// classes developed for this project
+#include <utils/jobs.h>
+#include <my_structs/halfedgedata.h>
+#include <my_structs/simplification.h>
+#include <my_structs/bvh.h>
+#include <my_structs/mesh_distance.h>
+#include <my_structs/voxel_remesh.h>
+#include <my_structs/obj_io.h>
+
+// --------------------GLOBAL VARIABLES SECTION---------------------
+
+// options of the command line
+std::string inputPath;
+std::string outputPath;
+std::string engine = "qem";
+std::size_t targetFaces = 0;
+float targetRatio = 0.5f;
+float maxError = std::numeric_limits<float>::infinity();
+float weldTolerance = 0.0f;
+float virtualPairsDistance = 0.0f;
+int voxelResolution = 64;
+bool smoothNormals = true;
+bool measureQuality = true;
+std::size_t threads = 0;
+
+// ---------------------FUNCTIONS SECTION---------------------
+
+// we measure the time of every step in milliseconds
+class Timer
+{
+public:
+    double Lap()
+    {
+        auto now = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(now - start).count();
+        start = now;
+        return ms;
+    }
+private:
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
+
+// we collapse edges with the engine until the mesh has at most target faces, it returns why the simplification stopped:
+// "target" (the mesh has at most target faces), "max_error" (the next collapse has a larger error), "min_faces" (the mesh
+// can't have less faces) or "no_valid_edge" (every edge left would break the mesh)
+template <typename Simplification>
+const char* RunEngine(my_structs::HalfEdgeMesh& mesh, std::size_t target)
+{
+    Simplification simplification(mesh);
+    if (virtualPairsDistance > 0.0f)
+        std::cerr << "simplify: " << simplification.AddVirtualPairs(virtualPairsDistance) << " virtual pairs" << std::endl;
+    while (mesh.faces.size() > target)
+    {
+        // a collapse removes two faces
+        int collapses = static_cast<int>(std::max<std::size_t>(1, (mesh.faces.size() - target) / 2));
+        if (!simplification.SimplifyMesh(collapses, maxError))
+            break;
+    }
+    const char* reason = "target";
+    if (mesh.faces.size() > target)
+    {
+        // SimplifyMesh checks the faces first and then the queue, before the error of the next edge
+        if (mesh.faces.size() <= 5)
+            reason = "min_faces";
+        else if (simplification.Exhausted())
+            reason = "no_valid_edge";
+        else
+            reason = "max_error";
+    }
+    simplification.ReorderMesh();
+    return reason;
+}
+
+// we replace the mesh with its voxel proxy, as a half-edge mesh so the output and the quality are measured as for the other engines
+std::unique_ptr<my_structs::HalfEdgeMesh> RunVoxelEngine(const my_structs::HalfEdgeMesh& mesh)
+{
+    my_structs::VoxelProxy proxy = my_structs::VoxelRemesh(mesh, voxelResolution);
+    std::vector<Vertex> vertices(proxy.positions.size(), Vertex{});
+    for (std::size_t i = 0; i < vertices.size(); ++i)
+    {
+        vertices[i].Position = proxy.positions[i];
+        vertices[i].Normal = proxy.normals[i];
+    }
+    std::vector<unsigned int> indices(proxy.indices.begin(), proxy.indices.end());
+    std::unique_ptr<my_structs::HalfEdgeMesh> remeshed(new my_structs::HalfEdgeMesh(vertices, indices));
+    remeshed->ReorderByMortonCurve();
+    return remeshed;
+}
+
+// number of vertices of the mesh (the corners with the same id are the same vertex)
+std::size_t CountVertices(const my_structs::HalfEdgeMesh& mesh)
+{
+    std::vector<char> used(mesh.vertex_count, 0);
+    std::size_t count = 0;
+    for (auto v : mesh.vertices)
+    {
+        if (!used[v->id])
+        {
+            used[v->id] = 1;
+            ++count;
+        }
+    }
+    return count;
+}
+
+bool ParseArguments(int argc, char* argv[])
+{
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--engine" && has_value)
+            engine = argv[++i];
+        else if (arg == "--faces" && has_value)
+            targetFaces = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--ratio" && has_value)
+            targetRatio = std::strtof(argv[++i], nullptr);
+        else if (arg == "--max-error" && has_value)
+            maxError = std::strtof(argv[++i], nullptr);
+        else if (arg == "--weld" && has_value)
+            weldTolerance = std::strtof(argv[++i], nullptr);
+        else if (arg == "--virtual-pairs" && has_value)
+            virtualPairsDistance = std::strtof(argv[++i], nullptr);
+        else if (arg == "--resolution" && has_value)
+            voxelResolution = std::atoi(argv[++i]);
+        else if (arg == "--threads" && has_value)
+            threads = std::strtoul(argv[++i], nullptr, 10);
+        else if (arg == "--flat")
+            smoothNormals = false;
+        else if (arg == "--no-quality")
+            measureQuality = false;
+        else if (arg.size() > 2 && arg[0] == '-' && arg[1] == '-')
+            return false;
+        else
+            positional.push_back(arg);
+    }
+    if (positional.size() != 2)
+        return false;
+    inputPath = positional[0];
+    outputPath = positional[1];
+    return engine == "qem" || engine == "qem-double" || engine == "qem-bucketed" || engine == "voxel";
+}
+
+// JSON strings: we escape the quotes, the backslashes (Windows paths) and the control characters
+std::string JsonString(const std::string& text)
+{
+    std::string out = "\"";
+    for (char c : text)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+// --------------------MAIN SECTION---------------------
+
+int main(int argc, char* argv[])
+{
+    if (!ParseArguments(argc, argv))
+    {
+        std::cerr << "usage: simplify input.obj output.obj [--engine qem | qem-double | qem-bucketed | voxel]" << std::endl
+                  << "                [--faces n | --ratio r] [--max-error e] [--weld t] [--virtual-pairs d]" << std::endl
+                  << "                [--resolution n] [--flat] [--no-quality] [--threads n]" << std::endl;
+        return 2;
+    }
+    // the messages of the library go on the standard error, the standard output has only the JSON
+    std::streambuf* coutBuffer = std::cout.rdbuf(std::cerr.rdbuf());
+    // the main thread works too, so it's one worker less than the threads
+    JobSystem::Shared(threads > 0 ? threads - 1 : JobSystem::kHardwareThreads);
+
+    Timer timer;
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    if (!my_structs::ReadObj(inputPath, vertices, indices) || indices.empty())
+    {
+        std::cerr << "simplify: can't read " << inputPath << std::endl;
+        std::cout.rdbuf(coutBuffer);
+        return 1;
+    }
+    double loadMs = timer.Lap();
+
+    my_structs::HalfEdgeMesh mesh(vertices, indices, weldTolerance);
+    mesh.ReorderByMortonCurve();
+    std::size_t facesBefore = mesh.faces.size();
+    std::size_t verticesBefore = CountVertices(mesh);
+    my_structs::ManifoldReport report = mesh.manifold_report;
+    std::size_t target = targetFaces > 0 ? targetFaces : static_cast<std::size_t>(targetRatio * facesBefore);
+    double buildMs = timer.Lap();
+
+    // the voxel engine creates a new mesh, the others simplify mesh
+    std::unique_ptr<my_structs::HalfEdgeMesh> proxy;
+    std::string stopReason;
+    if (engine == "voxel")
+    {
+        proxy = RunVoxelEngine(mesh);
+        stopReason = "resolution";
+    }
+    else if (engine == "qem-double")
+        stopReason = RunEngine<my_structs::MeshSimplification_QEM_Double>(mesh, target);
+    else if (engine == "qem-bucketed")
+        stopReason = RunEngine<my_structs::MeshSimplification_QEM_Bucketed>(mesh, target);
+    else
+        stopReason = RunEngine<my_structs::MeshSimplification_QEM>(mesh, target);
+    my_structs::HalfEdgeMesh& result = proxy ? *proxy : mesh;
+    double simplifyMs = timer.Lap();
+
+    std::vector<Vertex> verticesOut;
+    std::vector<unsigned int> indicesOut;
+    result.ConvertToBuffers(verticesOut, indicesOut, smoothNormals);
+    bool written = my_structs::WriteObj(outputPath, verticesOut, indicesOut);
+    double writeMs = timer.Lap();
+
+    // we measure the distance between the two surfaces at the vertices, in both directions
+    my_structs::SurfaceDistance toInput, toOutput;
+    double qualityMs = 0.0;
+    if (measureQuality)
+    {
+        my_structs::HalfEdgeMesh original(vertices, indices, weldTolerance);
+        my_structs::FaceBVH originalTree(original);
+        my_structs::FaceBVH simplifiedTree(result);
+        toInput = my_structs::VertexDistance(result, originalTree);
+        toOutput = my_structs::VertexDistance(original, simplifiedTree);
+        qualityMs = timer.Lap();
+    }
+    glm::vec3 min = vertices[0].Position, max = min;
+    for (auto& vertex : vertices)
+    {
+        min = glm::min(min, vertex.Position);
+        max = glm::max(max, vertex.Position);
+    }
+
+    std::cout.rdbuf(coutBuffer);
+    std::printf("{\n");
+    std::printf("  \"input\": %s,\n", JsonString(inputPath).c_str());
+    std::printf("  \"output\": %s,\n", JsonString(outputPath).c_str());
+    std::printf("  \"engine\": %s,\n", JsonString(engine).c_str());
+    std::printf("  \"threads\": %zu,\n", JobSystem::Shared().ThreadCount() + 1);
+    std::printf("  \"written\": %s,\n", written ? "true" : "false");
+    std::printf("  \"target_faces\": %zu,\n", target);
+    std::printf("  \"reached_target\": %s,\n", result.faces.size() <= target ? "true" : "false");
+    std::printf("  \"stop_reason\": %s,\n", JsonString(stopReason).c_str());
+    std::printf("  \"faces_before\": %zu,\n", facesBefore);
+    std::printf("  \"faces_after\": %zu,\n", result.faces.size());
+    std::printf("  \"vertices_before\": %zu,\n", verticesBefore);
+    std::printf("  \"vertices_after\": %zu,\n", CountVertices(result));
+    std::printf("  \"non_manifold_edges\": %zu,\n", static_cast<std::size_t>(report.non_manifold_edges));
+    std::printf("  \"non_manifold_vertices\": %zu,\n", static_cast<std::size_t>(report.non_manifold_vertices));
+    std::printf("  \"timings_ms\": {\"load\": %.3f, \"build\": %.3f, \"simplify\": %.3f, \"write\": %.3f, \"quality\": %.3f},\n",
+                loadMs, buildMs, simplifyMs, writeMs, qualityMs);
+    if (measureQuality)
+    {
+        std::printf("  \"quality\": {\"bounding_box_diagonal\": %.9g, \"hausdorff\": %.9g,\n", glm::length(max - min),
+                    std::max(toInput.max, toOutput.max));
+        std::printf("              \"output_to_input\": {\"max\": %.9g, \"rms\": %.9g},\n", toInput.max, toInput.rms);
+        std::printf("              \"input_to_output\": {\"max\": %.9g, \"rms\": %.9g}}\n", toOutput.max, toOutput.rms);
+    }
+    else
+        std::printf("  \"quality\": null\n");
+    std::printf("}\n");
+    return written ? 0 : 1;
+}
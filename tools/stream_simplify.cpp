@@ -0,0 +1,81 @@
+// Created by Andrea Pulita
+
+// Out-of-core simplification of an OBJ file larger than the memory:
+//   stream_simplify input.obj output.obj [--ratio r] [--max-error e] [--memory mb] [--work-dir dir]
+// the triangles are streamed in a chunked mesh file (see streaming.h) with
+// about mb megabytes of memory (256 by default), then the chunks are loaded
+// and simplified one at a time to the ratio r of their faces (0.5 by
+// default), with the vertices on the seams between the chunks locked, and
+// appended to output.obj. The temporary files go in dir (the current folder
+// by default)
+
+// --------------------INLCUDE SECTION---------------------
+
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+// classes developed for this project
+#include <my_structs/streaming.h>
+#include <my_structs/streamed_simplifier.h>
+
+// --------------------MAIN SECTION---------------------
+
+int main(int argc, char* argv[])
+{
+    my_structs::StreamingOptions streaming;
+    my_structs::StreamedSimplificationOptions options;
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if (arg == "--ratio" && has_value)
+            options.target_ratio = std::strtof(argv[++i], nullptr);
+        else if (arg == "--max-error" && has_value)
+            options.max_error = std::strtof(argv[++i], nullptr);
+        else if (arg == "--memory" && has_value)
+            streaming.memory_budget = std::strtoul(argv[++i], nullptr, 10) << 20;
+        else if (arg == "--work-dir" && has_value)
+            streaming.work_dir = argv[++i];
+        else
+            positional.push_back(arg);
+    }
+    if (positional.size() != 2)
+    {
+        std::cerr << "usage: stream_simplify input.obj output.obj [--ratio r] [--max-error e] [--memory mb] [--work-dir dir]"
+                  << std::endl;
+        return 2;
+    }
+
+    // we build the chunked file next to the other temporary files, and we remove it at the end
+    auto start = std::chrono::steady_clock::now();
+    std::string chunked_path = streaming.work_dir + "/stream_simplify.hestream";
+    bool built;
+    {
+        my_structs::ObjTriangleSource source(positional[0], streaming.work_dir + "/stream_simplify.positions");
+        built = my_structs::BuildStreamedMesh(source, chunked_path, streaming);
+    }
+    double build_seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    my_structs::StreamedSimplificationResult result;
+    if (built)
+    {
+        my_structs::StreamedMesh streamed(chunked_path);
+        result = my_structs::SimplifyStreamedMesh(streamed, positional[1], options);
+    }
+    std::remove(chunked_path.c_str());
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (!built || !result.written)
+    {
+        std::cerr << "stream_simplify: can't " << (built ? "write " + positional[1] : "stream " + positional[0]) << std::endl;
+        return 1;
+    }
+    std::cout << positional[0] << ": " << result.faces_before << " -> " << result.faces_after << " faces in "
+              << result.chunks << " chunks (" << result.locked_vertices << " seam vertices locked), "
+              << build_seconds << " s to stream, " << seconds << " s in total"
+              << (result.reached_target ? "" : " (target not reached)") << std::endl;
+    return 0;
+}